@@ -1,108 +1,4784 @@
 #include <aws/core/Aws.h>
 #include <aws/dynamodb/DynamoDBClient.h>
+#include <aws/dynamodb/DynamoDBRequest.h>
 #include <aws/core/http/standard/StandardHttpRequest.h>
+#include <aws/core/client/DefaultRetryStrategy.h>
+#include <aws/core/utils/threading/Executor.h>
+#include <aws/core/http/HttpClient.h>
+#include <aws/core/http/HttpClientFactory.h>
+#include <aws/core/utils/HashingUtils.h>
+#include <aws/core/utils/stream/ResponseStream.h>
 #include <aws/dynamodb/model/DescribeEndpointsRequest.h>
+#include <aws/dynamodb/model/DescribeTableRequest.h>
+#include <aws/dynamodb/model/GetItemRequest.h>
+#include <aws/dynamodb/model/PutItemRequest.h>
+#include <aws/dynamodb/model/UpdateItemRequest.h>
+#include <aws/dynamodb/model/DeleteItemRequest.h>
+#include <aws/dynamodb/model/BatchGetItemRequest.h>
+#include <aws/dynamodb/model/QueryRequest.h>
+#include <aws/dynamodb/model/BatchWriteItemRequest.h>
+#include <aws/dynamodb/model/ScanRequest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
 #include <mutex>
+#include <queue>
 #include <random>
+#if defined(__cpp_impl_coroutine)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define ALTERNATOR_COROUTINES 1
+#endif
+#endif
+// Compression needs zlib, so it is only available to applications which
+// define ALTERNATOR_ZLIB before including this header and link with zlib
+#ifdef ALTERNATOR_ZLIB
+#include <zlib.h>
+#endif
+
+// A value which is replaced by one thread and read by many. Each reader
+// keeps a thread-local reference to the last version it has seen, so that
+// reading costs a single atomic load and no reference counting unless the
+// value has changed since. std::atomic_load() on a shared_ptr is not
+// lock-free in common standard library implementations, so it is only used
+// after a change. Versions are unique across all instances with the same T,
+// so the cache stays correct when a thread alternates between several
+// clients - it just reloads more often.
+template<typename T>
+class AlternatorPublished {
+	// Only accessed via std::atomic_load/std::atomic_store
+	std::shared_ptr<const T> _value;
+	std::atomic<uint64_t> _version;
+
+	struct Cached {
+		uint64_t version = 0;
+		std::shared_ptr<const T> value;
+	};
+public:
+	AlternatorPublished() : _version(0) {
+		Publish(std::make_shared<const T>());
+	}
+
+	void Publish(std::shared_ptr<const T> value) {
+		static std::atomic<uint64_t> generation(0);
+		uint64_t version = generation.fetch_add(1, std::memory_order_relaxed) + 1;
+		std::atomic_store(&_value, std::move(value));
+		_version.store(version, std::memory_order_release);
+	}
+
+	std::shared_ptr<const T> Load() const {
+		return std::atomic_load(&_value);
+	}
+
+	// Returns the current value without touching its reference count. The
+	// reference points into a cache of the calling thread, which is shared
+	// by all instances with the same T, so it is only valid until the
+	// calling thread calls Local() on any AlternatorPublished<T> again: the
+	// value it refers to may be released by then. A caller which needs the
+	// value, or anything within it, for longer must copy what it keeps (e.g.
+	// the shared_ptr of a node) before that, or use Load() instead. The same
+	// holds for references and pointers into the value which callers return.
+	const T& Local() const {
+		static thread_local Cached cached;
+		uint64_t version = _version.load(std::memory_order_acquire);
+		if (cached.version != version) {
+			cached.value = Load();
+			cached.version = version;
+		}
+		return *cached.value;
+	}
+};
+
+// Approximate distribution of recent latencies. Bucket bounds grow by a
+// factor of 2^(1/4), so a percentile is off by at most 19%, and all counts
+// are halved every Window samples so that old samples fade out. Updates
+// race with the halving, which only makes the distribution less exact.
+class AlternatorLatencyHistogram {
+public:
+	static const size_t Buckets = 96;
+	static const uint32_t Window = 2048;
+
+	AlternatorLatencyHistogram() : _total(0) {
+		for (std::atomic<uint32_t>& count : _counts) {
+			count.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void Record(std::chrono::microseconds latency) {
+		_counts[Bucket(latency.count())].fetch_add(1, std::memory_order_relaxed);
+		if (_total.fetch_add(1, std::memory_order_relaxed) + 1 == Window) {
+			for (std::atomic<uint32_t>& count : _counts) {
+				count.store(count.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+			}
+			_total.fetch_sub(Window / 2, std::memory_order_relaxed);
+		}
+	}
+
+	// Sets ret to the upper bound of the bucket holding the given
+	// percentile, in [0, 1]. Returns false if there are fewer samples than
+	// min_samples.
+	bool Percentile(double percentile, uint32_t min_samples, std::chrono::microseconds& ret) const {
+		uint32_t total = _total.load(std::memory_order_relaxed);
+		if (total < min_samples || total == 0) {
+			return false;
+		}
+		uint64_t rank = static_cast<uint64_t>(percentile * total);
+		uint64_t seen = 0;
+		size_t bucket = 0;
+		for (; bucket < Buckets - 1; ++bucket) {
+			seen += _counts[bucket].load(std::memory_order_relaxed);
+			if (seen > rank) {
+				break;
+			}
+		}
+		ret = std::chrono::microseconds(UpperBound(bucket));
+		return true;
+	}
 
-class AlternatorClient : public Aws::DynamoDB::DynamoDBClient {
 protected:
-	Aws::String _protocol;
-	Aws::String _port;
-	mutable std::vector<Aws::Http::URI> _nodes;
-	mutable std::mutex _nodes_mutex;
-	mutable size_t _node_idx = 0;
-	mutable size_t _updater_idx = 0;
-	std::unique_ptr<std::thread> _node_updater;
-	std::atomic<bool> _keep_updating;
+	std::atomic<uint32_t> _counts[Buckets];
+	std::atomic<uint32_t> _total;
+
+	// Values below 4us have a bucket each, then every power of two is
+	// split into 4 buckets by the two bits following the leading one
+	static size_t Bucket(int64_t us) {
+		if (us < 4) {
+			return us < 0 ? 0 : static_cast<size_t>(us);
+		}
+		size_t log = 0;
+		for (uint64_t v = static_cast<uint64_t>(us); v > 1; v >>= 1) {
+			++log;
+		}
+		size_t sub = (static_cast<uint64_t>(us) >> (log - 2)) & 3;
+		return std::min((log - 1) * 4 + sub, Buckets - 1);
+	}
+
+	static int64_t UpperBound(size_t bucket) {
+		if (bucket < 4) {
+			return static_cast<int64_t>(bucket) + 1;
+		}
+		size_t log = bucket / 4 + 1;
+		return static_cast<int64_t>(5 + bucket % 4) << (log - 2);
+	}
+};
+
+// Latency distribution in fixed buckets, as exported to Prometheus
+struct AlternatorLatencyBuckets {
+	static const size_t Count = 16;
+
+	// Upper bounds of all buckets but the last one, which is unbounded
+	static const std::chrono::microseconds* Bounds() {
+		static const std::chrono::microseconds bounds[Count - 1] = {
+			std::chrono::microseconds(100), std::chrono::microseconds(250), std::chrono::microseconds(500),
+			std::chrono::microseconds(1000), std::chrono::microseconds(2500), std::chrono::microseconds(5000),
+			std::chrono::microseconds(10000), std::chrono::microseconds(25000), std::chrono::microseconds(50000),
+			std::chrono::microseconds(100000), std::chrono::microseconds(250000), std::chrono::microseconds(500000),
+			std::chrono::microseconds(1000000), std::chrono::microseconds(2500000), std::chrono::microseconds(5000000),
+		};
+		return bounds;
+	}
+
+	static size_t Bucket(std::chrono::microseconds latency) {
+		const std::chrono::microseconds* bounds = Bounds();
+		size_t bucket = 0;
+		while (bucket < Count - 1 && latency > bounds[bucket]) {
+			++bucket;
+		}
+		return bucket;
+	}
+};
+
+// Counts of requests, failures and latencies which are only ever added to.
+// Every thread adds to one of a few shards, each on cache lines of its own,
+// so that threads rarely contend; reading sums up the shards.
+class AlternatorRequestCounters {
 public:
-	AlternatorClient(Aws::String protocol, Aws::String control_addr, Aws::String port,
-			const Aws::Client::ClientConfiguration &clientConfiguration = Aws::Client::ClientConfiguration())
-		: Aws::DynamoDB::DynamoDBClient(clientConfiguration)
-		, _protocol(protocol)
-		, _port(port) {
-			Aws::Http::URI initial_node(protocol + "://" + control_addr + ":" + port);
-			_nodes.push_back(std::move(initial_node));
-			FetchLocalNodes();
+	enum Counter { REQUESTS, ERRORS, NODE_FAILURES, LATENCY_SUM_US, LATENCY_BUCKETS, COUNTERS = LATENCY_BUCKETS + AlternatorLatencyBuckets::Count };
+	static const size_t Shards = 8;
+
+	AlternatorRequestCounters() {
+		for (Shard& shard : _shards) {
+			for (std::atomic<uint64_t>& value : shard.values) {
+				value.store(0, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void Record(bool error, bool node_failure, std::chrono::microseconds latency) {
+		std::atomic<uint64_t>* values = _shards[ShardOfThisThread()].values;
+		values[REQUESTS].fetch_add(1, std::memory_order_relaxed);
+		if (error) {
+			values[ERRORS].fetch_add(1, std::memory_order_relaxed);
+		}
+		if (node_failure) {
+			values[NODE_FAILURES].fetch_add(1, std::memory_order_relaxed);
+		}
+		values[LATENCY_SUM_US].fetch_add(latency.count() > 0 ? latency.count() : 0, std::memory_order_relaxed);
+		values[LATENCY_BUCKETS + AlternatorLatencyBuckets::Bucket(latency)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	uint64_t Sum(size_t counter) const {
+		uint64_t ret = 0;
+		for (const Shard& shard : _shards) {
+			ret += shard.values[counter].load(std::memory_order_relaxed);
+		}
+		return ret;
+	}
+
+protected:
+	// Padded rather than aligned, as over-aligned allocation needs C++17:
+	// a full cache line between the values of two shards keeps them apart
+	struct Shard {
+		std::atomic<uint64_t> values[COUNTERS];
+		char padding[64];
+	};
+	Shard _shards[Shards];
+
+	static size_t ShardOfThisThread() {
+		static std::atomic<size_t> threads(0);
+		static thread_local size_t shard = threads.fetch_add(1, std::memory_order_relaxed) % Shards;
+		return shard;
+	}
+};
+
+// Storage for a response body which keeps its capacity for the next
+// response received by the same thread, so that a stream of large pages is
+// neither reallocated nor copied on its way to the parser
+class AlternatorResponseBuffer : public std::streambuf {
+public:
+	AlternatorResponseBuffer() : _read(0) {
+		_data.swap(Spare());
+		_data.clear();
+	}
+
+	~AlternatorResponseBuffer() {
+#ifdef ALTERNATOR_ZLIB
+		if (_inflater) {
+			inflateEnd(_inflater.get());
+		}
+#endif
+		_data.clear();
+		_data.swap(Spare());
+	}
+
+	const char* Data() const {
+		return _data.data();
+	}
+
+	size_t Size() const {
+		return _data.size();
+	}
+
+#ifdef ALTERNATOR_ZLIB
+	// Inflates the data received so far and all data after it, called once
+	// the response headers say that the body is gzip-compressed
+	void Decompress() {
+		if (_inflater || _corrupt) {
+			return;
+		}
+		_inflater.reset(new z_stream());
+		if (inflateInit2(_inflater.get(), 15 + 16) != Z_OK) {
+			_inflater.reset();
+			_corrupt = true;
+			return;
+		}
+		ForgetGetArea();
+		Aws::String compressed;
+		compressed.swap(_data);
+		_corrupt = !compressed.empty() && !Inflate(compressed.data(), compressed.size());
+	}
+#endif
+
+protected:
+	std::streamsize xsputn(const char* s, std::streamsize n) override {
+		ForgetGetArea();
+		return Append(s, static_cast<size_t>(n)) ? n : 0;
+	}
+
+	int_type overflow(int_type c) override {
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			ForgetGetArea();
+			char ch = traits_type::to_char_type(c);
+			if (!Append(&ch, 1)) {
+				return traits_type::eof();
+			}
+		}
+		return traits_type::not_eof(c);
+	}
+
+	// Reading is only needed for error responses, which the SDK parses itself
+	int_type underflow() override {
+		ForgetGetArea();
+		if (_read >= _data.size()) {
+			return traits_type::eof();
+		}
+		char* data = &_data[0];
+		setg(data, data + _read, data + _data.size());
+		return traits_type::to_int_type(*gptr());
+	}
+
+	pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+		if (which & std::ios_base::out) {
+			return off == 0 && dir != std::ios_base::beg ? pos_type(static_cast<off_type>(_data.size())) : pos_type(off_type(-1));
+		}
+		ForgetGetArea();
+		off_type base = dir == std::ios_base::beg ? 0 : dir == std::ios_base::cur ? static_cast<off_type>(_read) : static_cast<off_type>(_data.size());
+		return seekpos(pos_type(base + off), which);
+	}
+
+	pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+		off_type off = pos;
+		if ((which & std::ios_base::out) || off < 0 || off > static_cast<off_type>(_data.size())) {
+			return pos_type(off_type(-1));
+		}
+		ForgetGetArea();
+		_read = static_cast<size_t>(off);
+		return pos;
+	}
+
+private:
+	Aws::String _data;
+	// Read position while there is no get area
+	size_t _read;
+#ifdef ALTERNATOR_ZLIB
+	// Set once the body turns out to be compressed, see Decompress()
+	std::unique_ptr<z_stream> _inflater;
+	bool _corrupt = false;
+#endif
+
+	// Returns false if the data cannot be decompressed, which makes the
+	// HTTP client abort the response
+	bool Append(const char* s, size_t n) {
+#ifdef ALTERNATOR_ZLIB
+		if (_corrupt) {
+			return false;
+		}
+		if (_inflater) {
+			_corrupt = !Inflate(s, n);
+			return !_corrupt;
+		}
+#endif
+		_data.append(s, n);
+		return true;
+	}
+
+#ifdef ALTERNATOR_ZLIB
+	bool Inflate(const char* s, size_t n) {
+		z_stream& stream = *_inflater;
+		stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(s));
+		stream.avail_in = static_cast<uInt>(n);
+		while (stream.avail_in > 0) {
+			size_t size = _data.size();
+			size_t room = std::max<size_t>(4 * n, 16384);
+			_data.resize(size + room);
+			stream.next_out = reinterpret_cast<Bytef*>(&_data[size]);
+			stream.avail_out = static_cast<uInt>(room);
+			int ret = inflate(&stream, Z_NO_FLUSH);
+			_data.resize(size + room - stream.avail_out);
+			// Anything after the end of the compressed data is ignored
+			if (ret == Z_STREAM_END) {
+				return true;
+			}
+			if (ret != Z_OK) {
+				return false;
+			}
+		}
+		return true;
+	}
+#endif
+
+	static Aws::String& Spare() {
+		static thread_local Aws::String spare;
+		return spare;
+	}
+
+	// Appending may move the data, so the get area is set up again on the next read
+	void ForgetGetArea() {
+		if (eback()) {
+			_read = static_cast<size_t>(gptr() - eback());
+			setg(nullptr, nullptr, nullptr);
+		}
+	}
+};
+
+class AlternatorResponseStream : public Aws::IOStream {
+public:
+	AlternatorResponseStream() : Aws::IOStream(nullptr) {
+		rdbuf(&_buffer);
+	}
+
+	const AlternatorResponseBuffer& Buffer() const {
+		return _buffer;
+	}
+
+#ifdef ALTERNATOR_ZLIB
+	void Decompress() {
+		_buffer.Decompress();
+	}
+#endif
+
+	static Aws::IOStream* Create() {
+		return Aws::New<AlternatorResponseStream>("AlternatorClient");
+	}
+
+private:
+	AlternatorResponseBuffer _buffer;
+};
+
+// Reads a request body in place, from memory owned by someone else
+class AlternatorRequestBodyBuffer : public std::streambuf {
+public:
+	AlternatorRequestBodyBuffer(const char* data, size_t size) {
+		char* begin = const_cast<char*>(data);
+		setg(begin, begin, begin + size);
+	}
+
+protected:
+	pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+		off_type base = dir == std::ios_base::beg ? 0 : dir == std::ios_base::cur ? gptr() - eback() : egptr() - eback();
+		return seekpos(pos_type(base + off), which);
+	}
+
+	pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+		off_type off = pos;
+		if ((which & std::ios_base::out) || off < 0 || off > egptr() - eback()) {
+			return pos_type(off_type(-1));
+		}
+		setg(eback(), eback() + off, egptr());
+		return pos;
+	}
+};
+
+class AlternatorRequestBodyStream : public Aws::IOStream {
+public:
+	AlternatorRequestBodyStream(const char* data, size_t size) : Aws::IOStream(nullptr), _buffer(data, size) {
+		rdbuf(&_buffer);
+	}
+
+private:
+	AlternatorRequestBodyBuffer _buffer;
+};
+
+// A pull parser for the JSON of DynamoDB responses, which reads straight
+// from the response body instead of building a JsonValue document first.
+// Once the input turns out to be malformed, all reads fail and Failed()
+// returns true.
+class AlternatorJsonReader {
+public:
+	AlternatorJsonReader(const char* begin, const char* end) : _pos(begin), _end(end), _first(false), _depth(0), _failed(false) {}
+
+	bool Failed() const {
+		return _failed;
+	}
+
+	bool BeginObject() {
+		return Begin('{');
+	}
+
+	// Reads the name of the next member of the current object, or the end
+	// of the object, in which case it returns false
+	bool NextMember(Aws::String& name) {
+		if (!Next('}')) {
+			return false;
+		}
+		if (!ReadString(name) || !Consume(':')) {
+			return false;
+		}
+		_first = false;
+		return true;
+	}
+
+	bool BeginArray() {
+		return Begin('[');
+	}
+
+	// Returns false at the end of the current array
+	bool NextElement() {
+		if (!Next(']')) {
+			return false;
+		}
+		_first = false;
+		return true;
+	}
+
+	bool ReadString(Aws::String& out) {
+		if (!Consume('"')) {
+			return false;
+		}
+		const char* start = _pos;
+		while (_pos != _end && *_pos != '"' && *_pos != '\\') {
+			if (static_cast<unsigned char>(*_pos) < 0x20) {
+				return Fail();
+			}
+			++_pos;
+		}
+		out.assign(start, _pos);
+		while (_pos != _end && *_pos == '\\') {
+			if (++_pos == _end) {
+				return Fail();
+			}
+			switch (*_pos++) {
+			case '"': out.push_back('"'); break;
+			case '\\': out.push_back('\\'); break;
+			case '/': out.push_back('/'); break;
+			case 'b': out.push_back('\b'); break;
+			case 'f': out.push_back('\f'); break;
+			case 'n': out.push_back('\n'); break;
+			case 'r': out.push_back('\r'); break;
+			case 't': out.push_back('\t'); break;
+			case 'u':
+				if (!ReadEscapedCodePoint(out)) {
+					return false;
+				}
+				break;
+			default:
+				return Fail();
+			}
+			start = _pos;
+			while (_pos != _end && *_pos != '"' && *_pos != '\\') {
+				if (static_cast<unsigned char>(*_pos) < 0x20) {
+					return Fail();
+				}
+				++_pos;
+			}
+			out.append(start, _pos);
+		}
+		if (_pos == _end) {
+			return Fail();
+		}
+		++_pos;
+		return true;
+	}
+
+	bool ReadBool(bool& out) {
+		SkipWhitespace();
+		if (ConsumeLiteral("true")) {
+			out = true;
+		} else if (ConsumeLiteral("false")) {
+			out = false;
+		} else {
+			return Fail();
+		}
+		return true;
+	}
+
+	// Returns the first character of the next value, without reading it
+	char Peek() {
+		SkipWhitespace();
+		return _pos != _end ? *_pos : '\0';
+	}
+
+	bool ReadNumber(double& out) {
+		const char* begin;
+		const char* end;
+		if (!ReadRaw(begin, end)) {
+			return false;
+		}
+		Aws::String text(begin, end);
+		char* parsed = nullptr;
+		out = std::strtod(text.c_str(), &parsed);
+		if (text.empty() || *parsed != '\0') {
+			return Fail();
+		}
+		return true;
+	}
+
+	// Skips a value and returns where its JSON text starts and ends
+	bool ReadRaw(const char*& begin, const char*& end) {
+		SkipWhitespace();
+		begin = _pos;
+		SkipValue();
+		end = _pos;
+		return !_failed;
+	}
+
+	void SkipValue() {
+		SkipWhitespace();
+		if (_failed || _pos == _end) {
+			Fail();
+			return;
+		}
+		Aws::String ignored;
+		switch (*_pos) {
+		case '{':
+			BeginObject();
+			while (NextMember(ignored)) {
+				SkipValue();
+			}
+			break;
+		case '[':
+			BeginArray();
+			while (NextElement()) {
+				SkipValue();
+			}
+			break;
+		case '"':
+			ReadString(ignored);
+			break;
+		case 't':
+		case 'f': {
+			bool value;
+			ReadBool(value);
+			break;
+		}
+		case 'n':
+			if (!ConsumeLiteral("null")) {
+				Fail();
+			}
+			break;
+		default: {
+			const char* start = _pos;
+			while (_pos != _end && (std::isdigit(static_cast<unsigned char>(*_pos)) || std::strchr("+-.eE", *_pos))) {
+				++_pos;
+			}
+			if (_pos == start) {
+				Fail();
+			}
+		}
+		}
+	}
+
+	// Reads a DynamoDB attribute value, e.g. {"S": "text"}
+	bool ReadAttributeValue(Aws::DynamoDB::Model::AttributeValue& value) {
+		Aws::String type;
+		if (!BeginObject() || !NextMember(type)) {
+			return Fail();
+		}
+		Aws::String text;
+		if (type == "S" || type == "N" || type == "B") {
+			if (!ReadString(text)) {
+				return false;
+			}
+			if (type == "S") {
+				value.SetS(text);
+			} else if (type == "N") {
+				value.SetN(text);
+			} else {
+				value.SetB(Aws::Utils::HashingUtils::Base64Decode(text));
+			}
+		} else if (type == "SS" || type == "NS") {
+			Aws::Vector<Aws::String> set;
+			BeginArray();
+			while (NextElement() && ReadString(text)) {
+				set.push_back(text);
+			}
+			if (type == "SS") {
+				value.SetSS(set);
+			} else {
+				value.SetNS(set);
+			}
+		} else if (type == "BS") {
+			Aws::Vector<Aws::Utils::ByteBuffer> set;
+			BeginArray();
+			while (NextElement() && ReadString(text)) {
+				set.push_back(Aws::Utils::HashingUtils::Base64Decode(text));
+			}
+			value.SetBS(set);
+		} else if (type == "BOOL" || type == "NULL") {
+			bool flag;
+			if (!ReadBool(flag)) {
+				return false;
+			}
+			if (type == "BOOL") {
+				value.SetBool(flag);
+			} else {
+				value.SetNull(flag);
+			}
+		} else if (type == "M") {
+			BeginObject();
+			while (NextMember(text)) {
+				std::shared_ptr<Aws::DynamoDB::Model::AttributeValue> member = std::make_shared<Aws::DynamoDB::Model::AttributeValue>();
+				if (!ReadAttributeValue(*member)) {
+					return false;
+				}
+				value.AddMEntry(text, member);
+			}
+		} else if (type == "L") {
+			BeginArray();
+			while (NextElement()) {
+				std::shared_ptr<Aws::DynamoDB::Model::AttributeValue> element = std::make_shared<Aws::DynamoDB::Model::AttributeValue>();
+				if (!ReadAttributeValue(*element)) {
+					return false;
+				}
+				value.AddLItem(element);
+			}
+		} else {
+			return Fail();
+		}
+		// A value has exactly one type
+		if (NextMember(type)) {
+			return Fail();
+		}
+		return !_failed;
+	}
+
+	// Reads an item or a key, e.g. {"p": {"S": "dog"}, "c": {"N": "1"}}
+	bool ReadItem(Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue>& item) {
+		Aws::String name;
+		BeginObject();
+		while (NextMember(name)) {
+			if (!ReadAttributeValue(item[name])) {
+				return false;
+			}
+		}
+		return !_failed;
+	}
+
+private:
+	// DynamoDB allows 32 levels of nested attributes
+	static const int MaxDepth = 100;
+
+	const char* _pos;
+	const char* _end;
+	// Set right after an object or array begins, when no comma is expected
+	bool _first;
+	int _depth;
+	bool _failed;
+
+	bool Fail() {
+		_failed = true;
+		_pos = _end;
+		return false;
+	}
+
+	void SkipWhitespace() {
+		while (_pos != _end && (*_pos == ' ' || *_pos == '\n' || *_pos == '\r' || *_pos == '\t')) {
+			++_pos;
+		}
+	}
+
+	bool Consume(char c) {
+		SkipWhitespace();
+		if (_pos == _end || *_pos != c) {
+			return Fail();
+		}
+		++_pos;
+		return true;
+	}
+
+	bool ConsumeLiteral(const char* literal) {
+		size_t length = std::strlen(literal);
+		if (static_cast<size_t>(_end - _pos) < length || std::memcmp(_pos, literal, length) != 0) {
+			return false;
+		}
+		_pos += length;
+		return true;
+	}
+
+	bool Begin(char c) {
+		if (_failed || !Consume(c)) {
+			return false;
+		}
+		if (++_depth > MaxDepth) {
+			return Fail();
+		}
+		_first = true;
+		return true;
+	}
+
+	// Consumes the separator before the next member or element, or the end
+	// of the current object or array, in which case it returns false
+	bool Next(char close) {
+		if (_failed) {
+			return false;
+		}
+		SkipWhitespace();
+		if (_pos != _end && *_pos == close) {
+			++_pos;
+			--_depth;
+			_first = false;
+			return false;
+		}
+		if (!_first) {
+			return Consume(',');
+		}
+		return true;
+	}
+
+	bool ReadHex4(uint32_t& out) {
+		if (_end - _pos < 4) {
+			return Fail();
+		}
+		out = 0;
+		for (int i = 0; i < 4; ++i) {
+			char c = *_pos++;
+			out <<= 4;
+			if (c >= '0' && c <= '9') {
+				out |= c - '0';
+			} else if (c >= 'a' && c <= 'f') {
+				out |= c - 'a' + 10;
+			} else if (c >= 'A' && c <= 'F') {
+				out |= c - 'A' + 10;
+			} else {
+				return Fail();
+			}
+		}
+		return true;
+	}
+
+	// Appends a \uXXXX escape, or a surrogate pair of them, as UTF-8
+	bool ReadEscapedCodePoint(Aws::String& out) {
+		uint32_t code;
+		if (!ReadHex4(code)) {
+			return false;
+		}
+		if (code >= 0xD800 && code < 0xDC00) {
+			uint32_t low;
+			if (!ConsumeLiteral("\\u") || !ReadHex4(low) || low < 0xDC00 || low >= 0xE000) {
+				return Fail();
+			}
+			code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+		} else if (code >= 0xDC00 && code < 0xE000) {
+			return Fail();
+		}
+		if (code < 0x80) {
+			out.push_back(static_cast<char>(code));
+		} else if (code < 0x800) {
+			out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+			out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+		} else if (code < 0x10000) {
+			out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+			out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+		} else {
+			out.push_back(static_cast<char>(0xF0 | (code >> 18)));
+			out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+		}
+		return true;
+	}
+};
+
+// Builds the JSON body of a PutItem or BatchWriteItem request straight from
+// attribute names and values, without AttributeValue objects, maps or a
+// JSON document in between, e.g.
+//   writer.BeginBatchWrite("table");
+//   writer.BeginItem();
+//   writer.String("id", id, id_size);
+//   writer.Number("count", 42);
+//   writer.EndItem();
+//   ...
+//   writer.End();
+//   client.Write(writer);
+// Begin...() empties the buffer without releasing it, so a writer reused
+// for request after request stops allocating once its buffer has grown to
+// the largest body. Names and values are copied as they are given, so they
+// can point into any buffer. Attribute names are nullptr inside lists. A
+// writer is used by one thread at a time.
+class AlternatorItemWriter {
+public:
+	AlternatorItemWriter() : _operation(""), _items(0), _first(true) {}
+
+	void BeginPutItem(const char* table) {
+		Begin("PutItem");
+		_body += "{\"TableName\":";
+		Quoted(table, std::strlen(table));
+		_body += ",\"Item\":{";
+		_first = true;
+	}
+
+	// Each item of the batch is then written between BeginItem() and EndItem()
+	void BeginBatchWrite(const char* table) {
+		Begin("BatchWriteItem");
+		_body += "{\"RequestItems\":{";
+		Quoted(table, std::strlen(table));
+		_body += ":[";
+	}
+
+	void BeginItem() {
+		if (_items++ > 0) {
+			_body += ',';
+		}
+		_body += "{\"PutRequest\":{\"Item\":{";
+		_first = true;
+	}
+
+	void EndItem() {
+		_body += "}}}";
+	}
+
+	void End() {
+		_body += std::strcmp(_operation, "PutItem") == 0 ? "}}" : "]}}";
+	}
+
+	void String(const char* name, const char* value, size_t size) {
+		Typed(name, "S");
+		Quoted(value, size);
+		_body += '}';
+	}
+
+	void String(const char* name, const char* value) {
+		String(name, value, std::strlen(value));
+	}
+
+	// A number given as its decimal text, e.g. for decimals
+	void Number(const char* name, const char* text, size_t size) {
+		Typed(name, "N");
+		Quoted(text, size);
+		_body += '}';
+	}
+
+	void Number(const char* name, int64_t value) {
+		char text[24];
+		int size = std::snprintf(text, sizeof(text), "%lld", static_cast<long long>(value));
+		Number(name, text, static_cast<size_t>(size));
+	}
+
+	void Binary(const char* name, const unsigned char* data, size_t size) {
+		static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		Typed(name, "B");
+		_body += '"';
+		for (size_t i = 0; i < size; i += 3) {
+			uint32_t group = static_cast<uint32_t>(data[i]) << 16;
+			if (i + 1 < size) {
+				group |= static_cast<uint32_t>(data[i + 1]) << 8;
+			}
+			if (i + 2 < size) {
+				group |= data[i + 2];
+			}
+			_body += digits[group >> 18];
+			_body += digits[(group >> 12) & 0x3F];
+			_body += i + 1 < size ? digits[(group >> 6) & 0x3F] : '=';
+			_body += i + 2 < size ? digits[group & 0x3F] : '=';
+		}
+		_body += "\"}";
+	}
+
+	void Bool(const char* name, bool value) {
+		Typed(name, "BOOL");
+		_body += value ? "true}" : "false}";
+	}
+
+	void Null(const char* name) {
+		Typed(name, "NULL");
+		_body += "true}";
+	}
+
+	// The attributes of the map follow, until EndMap()
+	void BeginMap(const char* name) {
+		Typed(name, "M");
+		_body += '{';
+		_first = true;
+	}
+
+	void EndMap() {
+		_body += "}}";
+		_first = false;
+	}
+
+	// The elements of the list follow, with nullptr names, until EndList()
+	void BeginList(const char* name) {
+		Typed(name, "L");
+		_body += '[';
+		_first = true;
+	}
+
+	void EndList() {
+		_body += "]}";
+		_first = false;
+	}
+
+	const char* Operation() const {
+		return _operation;
+	}
+
+	const Aws::String& Body() const {
+		return _body;
+	}
+
+	// Items of the batch so far
+	size_t Items() const {
+		return _items;
+	}
+
+protected:
+	Aws::String _body;
+	const char* _operation;
+	size_t _items;
+	// Whether the next attribute or element is the first of its item, map or list
+	bool _first;
+
+	void Begin(const char* operation) {
+		_body.clear();
+		_operation = operation;
+		_items = 0;
+	}
+
+	// Writes the name, if any, and opens the attribute value
+	void Typed(const char* name, const char* type) {
+		if (!_first) {
+			_body += ',';
+		}
+		_first = false;
+		if (name) {
+			Quoted(name, std::strlen(name));
+			_body += ':';
+		}
+		_body += "{\"";
+		_body += type;
+		_body += "\":";
+	}
+
+	void Quoted(const char* text, size_t size) {
+		static const char hex[] = "0123456789abcdef";
+		_body += '"';
+		const char* end = text + size;
+		while (text != end) {
+			const char* plain = text;
+			while (text != end && *text != '"' && *text != '\\' && static_cast<unsigned char>(*text) >= 0x20) {
+				++text;
+			}
+			_body.append(plain, text);
+			if (text == end) {
+				break;
+			}
+			unsigned char c = static_cast<unsigned char>(*text++);
+			if (c == '"' || c == '\\') {
+				_body += '\\';
+				_body += static_cast<char>(c);
+			} else {
+				_body += "\\u00";
+				_body += hex[c >> 4];
+				_body += hex[c & 0xF];
+			}
+		}
+		_body += '"';
+	}
+};
+
+// A request whose JSON body is already serialized, e.g. by
+// AlternatorItemWriter. The body is read in place rather than copied, so it
+// must outlive the request.
+class AlternatorRawRequest : public Aws::DynamoDB::DynamoDBRequest {
+public:
+	AlternatorRawRequest(const char* operation, const char* body, size_t size)
+		: _operation(operation)
+		, _body(body)
+		, _size(size) {}
+
+	virtual const char* GetServiceRequestName() const override {
+		return _operation;
+	}
+
+	virtual Aws::String SerializePayload() const override {
+		return Aws::String(_body, _size);
+	}
+
+	virtual std::shared_ptr<Aws::IOStream> GetBody() const override {
+		return Aws::MakeShared<AlternatorRequestBodyStream>("AlternatorClient", _body, _size);
+	}
+
+protected:
+	const char* _operation;
+	const char* _body;
+	size_t _size;
+
+	virtual Aws::Http::HeaderValueCollection GetRequestSpecificHeaders() const override {
+		Aws::Http::HeaderValueCollection headers;
+		headers.emplace("X-Amz-Target", "DynamoDB_20120810." + Aws::String(_operation));
+		return headers;
+	}
+};
+
+// A single Alternator node, parsed once when the node list is fetched.
+// Routing a request only copies host and port into the request's URI,
+// which reuses the URI's existing string buffers instead of allocating.
+// Nodes are kept across refreshes of the node list as long as they stay
+// in it, so the request statistics below outlive a single snapshot.
+struct AlternatorNode {
+	Aws::Http::Scheme scheme;
+	Aws::String host;
+	uint16_t port;
+	Aws::Http::URI uri;
+
+	std::atomic<uint32_t> in_flight;
+	// Exponentially weighted moving average of response latency,
+	// 0 until the first response arrives
+	std::atomic<int64_t> latency_ewma_us;
+	AlternatorLatencyHistogram latency_histogram;
+	AlternatorRequestCounters counters;
+	// Failed attempts in a row which point at the node itself, see
+	// AlternatorAttempt::IsNodeFailure()
+	std::atomic<uint32_t> consecutive_failures;
+	// A quarantined node receives no requests until a health probe succeeds
+	std::atomic<bool> quarantined;
+	// Requests allowed in flight, see AlternatorConcurrencyLimitOptions,
+	// 0 until the limit first adapts
+	std::atomic<double> concurrency_limit;
+	// Set once the node refused a compressed request body
+	std::atomic<bool> rejects_compression;
+	// The node's own latest report of its load, negative without any, see
+	// AlternatorLoadAwarePolicy
+	std::atomic<double> reported_load;
+	// FNV-1a of the host, see AlternatorClient::PickByRendezvous()
+	uint64_t host_hash;
+
+	AlternatorNode(Aws::Http::Scheme scheme, const Aws::String& host, uint16_t port)
+		: scheme(scheme)
+		, host(host)
+		, port(port)
+		, in_flight(0)
+		, latency_ewma_us(0)
+		, consecutive_failures(0)
+		, quarantined(false)
+		, concurrency_limit(0)
+		, rejects_compression(false)
+		, reported_load(-1)
+		, host_hash(14695981039346656037ULL) {
+			for (char c : host) {
+				host_hash = (host_hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+			}
+			uri.SetScheme(scheme);
+			uri.SetAuthority(host);
+			uri.SetPort(port);
+		}
+
+	void RecordLatency(std::chrono::microseconds latency) {
+		// Concurrent updates may occasionally lose a sample, which is fine for an average
+		int64_t sample = latency.count();
+		int64_t old = latency_ewma_us.load(std::memory_order_relaxed);
+		int64_t updated = old == 0 ? sample : old + (sample - old) / 8;
+		latency_ewma_us.store(std::max<int64_t>(updated, 1), std::memory_order_relaxed);
+		latency_histogram.Record(latency);
+	}
+
+	bool IsHealthy() const {
+		return !quarantined.load(std::memory_order_relaxed);
+	}
+
+	void RecordSuccess() {
+		if (consecutive_failures.load(std::memory_order_relaxed) != 0) {
+			consecutive_failures.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	// Returns true if this failure is the one which put the node in quarantine
+	bool RecordFailure(uint32_t quarantine_threshold) {
+		if (consecutive_failures.fetch_add(1, std::memory_order_relaxed) + 1 < quarantine_threshold) {
+			return false;
+		}
+		return !quarantined.exchange(true);
+	}
+
+	void Readmit() {
+		consecutive_failures.store(0, std::memory_order_relaxed);
+		quarantined.store(false);
+	}
+};
+
+// Controls when nodes are quarantined, see AlternatorClient::SetHealthCheckOptions()
+struct AlternatorHealthCheckOptions {
+	// Consecutive connection errors, timeouts or 503/504 responses after
+	// which a node is quarantined
+	uint32_t quarantine_threshold;
+	// Delay before the first health probe of a quarantined node, doubled
+	// after every failed probe up to max_probe_interval
+	std::chrono::milliseconds probe_interval;
+	std::chrono::milliseconds max_probe_interval;
+
+	AlternatorHealthCheckOptions()
+		: quarantine_threshold(3)
+		, probe_interval(100)
+		, max_probe_interval(5000) {}
+};
+
+// An immutable list of Alternator nodes. Once published, a snapshot is never
+// modified - FetchLocalNodes() builds a new one and atomically swaps it in,
+// so that routing a request never needs to take a lock.
+struct AlternatorNodeSnapshot {
+	std::vector<std::shared_ptr<AlternatorNode>> nodes;
+	// With a preferred rack, nodes holds the nodes in that rack and fallback
+	// the remaining nodes of the datacenter, used when none of the rack's
+	// nodes are healthy
+	std::shared_ptr<const AlternatorNodeSnapshot> fallback;
+	// Unique among all snapshots ever created, never 0. Unlike the address,
+	// which a new snapshot may reuse once an old one is freed, it tells
+	// snapshots apart, e.g. for state a policy derives from one.
+	uint64_t generation;
+
+	AlternatorNodeSnapshot() : generation(NextGeneration()) {}
+
+private:
+	static uint64_t NextGeneration() {
+		static std::atomic<uint64_t> last(0);
+		return last.fetch_add(1, std::memory_order_relaxed) + 1;
+	}
+};
+
+// Key schema and token ring of a single table, used for token-aware routing.
+// A table which cannot be routed by token, e.g. because its partition key
+// is a number, has an empty hash_key.
+struct AlternatorTableRing {
+	Aws::String hash_key;
+	Aws::DynamoDB::Model::ScalarAttributeType hash_key_type;
+	// Range i owns the tokens in (end_tokens[i - 1], end_tokens[i]], and
+	// range 0 also wraps around past the last end token
+	std::vector<int64_t> end_tokens;
+	// Replicas of each range which are known to the client, those in the
+	// preferred rack (or datacenter) first
+	std::vector<std::vector<std::shared_ptr<AlternatorNode>>> replicas;
+	std::vector<size_t> preferred_replicas;
+	// Value of AlternatorClient::_topology_epoch when the ring was loaded
+	uint64_t topology_epoch;
+	std::chrono::steady_clock::time_point loaded;
+	mutable std::atomic<bool> reloading;
+
+	AlternatorTableRing()
+		: hash_key_type(Aws::DynamoDB::Model::ScalarAttributeType::S)
+		, topology_epoch(0)
+		, loaded(std::chrono::steady_clock::now())
+		, reloading(false) {}
+
+	static const std::chrono::seconds& TimeToLive() {
+		static const std::chrono::seconds ttl(60);
+		return ttl;
+	}
+
+	const std::vector<std::shared_ptr<AlternatorNode>>* Replicas(int64_t token, size_t& preferred) const {
+		if (end_tokens.empty()) {
+			return nullptr;
+		}
+		size_t idx = std::lower_bound(end_tokens.begin(), end_tokens.end(), token) - end_tokens.begin();
+		if (idx == end_tokens.size()) {
+			idx = 0;
+		}
+		preferred = preferred_replicas[idx];
+		return &replicas[idx];
+	}
+
+	// Scylla's Murmur3Partitioner: the first half of the 128-bit x64 variant
+	// of MurmurHash3, including Cassandra's quirk of sign-extending the
+	// trailing bytes.
+	static int64_t Token(const unsigned char* data, size_t length) {
+		const uint64_t c1 = 0x87c37b91114253d5ULL;
+		const uint64_t c2 = 0x4cf5ad432745937fULL;
+		uint64_t h1 = 0;
+		uint64_t h2 = 0;
+		size_t nblocks = length / 16;
+		for (size_t i = 0; i < nblocks; ++i) {
+			uint64_t k1 = ReadLittleEndian(data + i * 16);
+			uint64_t k2 = ReadLittleEndian(data + i * 16 + 8);
+			k1 *= c1; k1 = RotateLeft(k1, 31); k1 *= c2; h1 ^= k1;
+			h1 = RotateLeft(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+			k2 *= c2; k2 = RotateLeft(k2, 33); k2 *= c1; h2 ^= k2;
+			h2 = RotateLeft(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+		}
+		const unsigned char* tail = data + nblocks * 16;
+		uint64_t k1 = 0;
+		uint64_t k2 = 0;
+		switch (length & 15) {
+		case 15: k2 ^= SignExtend(tail[14]) << 48; // fallthrough
+		case 14: k2 ^= SignExtend(tail[13]) << 40; // fallthrough
+		case 13: k2 ^= SignExtend(tail[12]) << 32; // fallthrough
+		case 12: k2 ^= SignExtend(tail[11]) << 24; // fallthrough
+		case 11: k2 ^= SignExtend(tail[10]) << 16; // fallthrough
+		case 10: k2 ^= SignExtend(tail[9]) << 8; // fallthrough
+		case 9: k2 ^= SignExtend(tail[8]);
+			k2 *= c2; k2 = RotateLeft(k2, 33); k2 *= c1; h2 ^= k2;
+			// fallthrough
+		case 8: k1 ^= SignExtend(tail[7]) << 56; // fallthrough
+		case 7: k1 ^= SignExtend(tail[6]) << 48; // fallthrough
+		case 6: k1 ^= SignExtend(tail[5]) << 40; // fallthrough
+		case 5: k1 ^= SignExtend(tail[4]) << 32; // fallthrough
+		case 4: k1 ^= SignExtend(tail[3]) << 24; // fallthrough
+		case 3: k1 ^= SignExtend(tail[2]) << 16; // fallthrough
+		case 2: k1 ^= SignExtend(tail[1]) << 8; // fallthrough
+		case 1: k1 ^= SignExtend(tail[0]);
+			k1 *= c1; k1 = RotateLeft(k1, 31); k1 *= c2; h1 ^= k1;
+		}
+		h1 ^= length;
+		h2 ^= length;
+		h1 += h2;
+		h2 += h1;
+		h1 = FinalMix(h1);
+		h2 = FinalMix(h2);
+		h1 += h2;
+		int64_t token = static_cast<int64_t>(h1);
+		return token == std::numeric_limits<int64_t>::min() ? std::numeric_limits<int64_t>::max() : token;
+	}
+
+private:
+	static uint64_t ReadLittleEndian(const unsigned char* p) {
+		uint64_t ret = 0;
+		for (int i = 7; i >= 0; --i) {
+			ret = (ret << 8) | p[i];
+		}
+		return ret;
+	}
+
+	static uint64_t SignExtend(unsigned char c) {
+		return static_cast<uint64_t>(static_cast<int64_t>(static_cast<signed char>(c)));
+	}
+
+	static uint64_t RotateLeft(uint64_t x, int r) {
+		return (x << r) | (x >> (64 - r));
+	}
+
+public:
+	static uint64_t FinalMix(uint64_t k) {
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdULL;
+		k ^= k >> 33;
+		k *= 0xc4ceb9fe1a85ec53ULL;
+		k ^= k >> 33;
+		return k;
+	}
+};
+
+// Decides which node serves the next request, by returning its index in
+// snapshot.nodes. Select() is called concurrently by all threads sending
+// requests, so it must be thread-safe and should not block. The snapshot
+// passed to it is never empty. If the chosen node turns out to be
+// unhealthy, AlternatorClient moves on to the next healthy one.
+class AlternatorNodeSelectionPolicy {
+public:
+	virtual ~AlternatorNodeSelectionPolicy() {}
+	virtual size_t Select(const AlternatorNodeSnapshot& snapshot) = 0;
+	// Called after a new node list is published
+	virtual void NodesChanged(const AlternatorNodeSnapshot&) {}
+	// Identifies the policy in traces, see AlternatorTracer
+	virtual const char* Name() const {
+		return "custom";
+	}
+};
+
+class AlternatorRoundRobinPolicy : public AlternatorNodeSelectionPolicy {
+	std::atomic<size_t> _node_idx;
+public:
+	AlternatorRoundRobinPolicy() : _node_idx(0) {}
+
+	virtual const char* Name() const override {
+		return "round-robin";
+	}
+
+	// The cursor carries over changes of the node list, which would
+	// otherwise send the next requests to the first nodes every time
+	virtual size_t Select(const AlternatorNodeSnapshot& snapshot) override {
+		return _node_idx.fetch_add(1, std::memory_order_relaxed) % snapshot.nodes.size();
+	}
+};
+
+// Round-robin over a cursor of the calling thread rather than a shared one,
+// so that threads on different cores never write to the same cache line.
+// Each thread starts at a random node, which spreads the requests of many
+// threads as evenly as a shared cursor would, while the requests of a
+// single thread still visit every node in turn.
+class AlternatorPerThreadRoundRobinPolicy : public AlternatorNodeSelectionPolicy {
+public:
+	virtual const char* Name() const override {
+		return "per-thread-round-robin";
+	}
+
+	virtual size_t Select(const AlternatorNodeSnapshot& snapshot) override {
+		static thread_local Cursor cursor;
+		return cursor.position++ % snapshot.nodes.size();
+	}
+
+protected:
+	// Padded so that no other thread's data shares its cache line
+	struct Cursor {
+		char padding_before[64];
+		size_t position;
+		char padding_after[64];
+		Cursor() : position(std::minstd_rand(std::random_device{}())()) {}
+	};
+};
+
+// Picks two nodes at random and sends the request to the one with the lower
+// expected cost: its average latency scaled by the number of requests
+// already in flight to it. A node stalled by compaction or GC quickly piles
+// up in-flight requests and stops being chosen, while checking only two
+// candidates keeps the choice cheap and avoids herding onto a single node.
+class AlternatorPowerOfTwoChoicesPolicy : public AlternatorNodeSelectionPolicy {
+public:
+	virtual const char* Name() const override {
+		return "power-of-two-choices";
+	}
+
+	virtual size_t Select(const AlternatorNodeSnapshot& snapshot) override {
+		return BetterOfTwo(snapshot, [](const AlternatorNode& node, const AlternatorNode&) {
+			return Cost(node);
+		});
+	}
+
+protected:
+	// Picks two distinct nodes at random and returns the index of the one
+	// with the lower score(node, other), where other is the node it is
+	// compared with
+	template <typename Score>
+	static size_t BetterOfTwo(const AlternatorNodeSnapshot& snapshot, Score score) {
+		static thread_local std::minstd_rand rng(std::random_device{}());
+		size_t n = snapshot.nodes.size();
+		if (n == 1) {
+			return 0;
+		}
+		size_t a = rng() % n;
+		size_t b = rng() % (n - 1);
+		if (b >= a) {
+			++b;
+		}
+		const AlternatorNode& node_a = *snapshot.nodes[a];
+		const AlternatorNode& node_b = *snapshot.nodes[b];
+		return score(node_a, node_b) <= score(node_b, node_a) ? a : b;
+	}
+
+	static uint64_t Cost(const AlternatorNode& node) {
+		uint64_t latency = node.latency_ewma_us.load(std::memory_order_relaxed);
+		uint64_t in_flight = node.in_flight.load(std::memory_order_relaxed);
+		return (latency + 1) * (in_flight + 1);
+	}
+};
+
+// Like AlternatorPowerOfTwoChoicesPolicy, but also weighs in the load which
+// nodes report about themselves - in the node list or in a response header,
+// see AlternatorClient::SetLoadHeader() - as the fraction of their capacity
+// in use. A node's cost is multiplied by 1 + sensitivity * load, so the
+// client's own view of latency and in-flight requests is corrected by what
+// only the node knows, e.g. load from other clients or from compaction.
+// Between a node which reports its load and one which does not, only the
+// client's view decides.
+class AlternatorLoadAwarePolicy : public AlternatorPowerOfTwoChoicesPolicy {
+public:
+	explicit AlternatorLoadAwarePolicy(double sensitivity = 4) : _sensitivity(sensitivity) {}
+
+	virtual const char* Name() const override {
+		return "load-aware";
+	}
+
+	virtual size_t Select(const AlternatorNodeSnapshot& snapshot) override {
+		double sensitivity = _sensitivity;
+		return BetterOfTwo(snapshot, [sensitivity](const AlternatorNode& node, const AlternatorNode& other) {
+			double load = node.reported_load.load(std::memory_order_relaxed);
+			if (load < 0 || other.reported_load.load(std::memory_order_relaxed) < 0) {
+				load = 0;
+			}
+			return Cost(node) * (1 + sensitivity * load);
+		});
+	}
+
+protected:
+	double _sensitivity;
+};
+
+// Smooth weighted round-robin, as in nginx: each node receives a share of
+// the requests proportional to its weight, interleaved with the other
+// nodes' instead of in bursts. The order of a whole cycle is computed when
+// the node list or the weights change, so that picking a node is a single
+// lookup. Weights are given per host, e.g. its number of vCPUs or shards.
+// Hosts without a weight get default_weight, and a node with weight 0
+// receives requests only when no node with a weight can take them.
+class AlternatorWeightedRoundRobinPolicy : public AlternatorNodeSelectionPolicy {
+public:
+	explicit AlternatorWeightedRoundRobinPolicy(const Aws::Map<Aws::String, uint32_t>& weights = Aws::Map<Aws::String, uint32_t>(),
+			uint32_t default_weight = 1)
+		: _position(0)
+		, _weights(weights)
+		, _default_weight(default_weight) {}
+
+	virtual const char* Name() const override {
+		return "weighted-round-robin";
+	}
+
+	// Replaces the weights, which apply to the current node list right away
+	void SetWeights(const Aws::Map<Aws::String, uint32_t>& weights) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_weights = weights;
+		Rebuild();
+	}
+
+	virtual size_t Select(const AlternatorNodeSnapshot& snapshot) override {
+		const Schedules& schedules = _schedules.Local();
+		size_t position = _position.fetch_add(1, std::memory_order_relaxed);
+		const Schedule& schedule = snapshot.generation == schedules.fallback.generation ? schedules.fallback : schedules.primary;
+		// Until NodesChanged() is called for a new snapshot, the old
+		// schedule no longer applies
+		if (schedule.generation != snapshot.generation || schedule.nodes != snapshot.nodes.size() || schedule.cycle.empty()) {
+			return position % snapshot.nodes.size();
+		}
+		return schedule.cycle[position % schedule.cycle.size()];
+	}
+
+	virtual void NodesChanged(const AlternatorNodeSnapshot& snapshot) override {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_primary_generation = snapshot.generation;
+		_primary_hosts = Hosts(snapshot);
+		_fallback_generation = snapshot.fallback ? snapshot.fallback->generation : 0;
+		_fallback_hosts = snapshot.fallback ? Hosts(*snapshot.fallback) : std::vector<Aws::String>();
+		Rebuild();
+	}
+
+private:
+	// Weights are scaled down to keep the cycle at most this long
+	static const uint64_t MaxCycle = 4096;
+
+	struct Schedule {
+		// Generation of the snapshot that cycle holds indexes into, 0 if none
+		uint64_t generation;
+		size_t nodes;
+		std::vector<uint32_t> cycle;
+
+		Schedule() : generation(0), nodes(0) {}
+	};
+
+	struct Schedules {
+		Schedule primary;
+		Schedule fallback;
+	};
+
+	AlternatorPublished<Schedules> _schedules;
+	std::atomic<size_t> _position;
+
+	std::mutex _mutex;
+	Aws::Map<Aws::String, uint32_t> _weights;
+	uint32_t _default_weight;
+	uint64_t _primary_generation = 0;
+	std::vector<Aws::String> _primary_hosts;
+	uint64_t _fallback_generation = 0;
+	std::vector<Aws::String> _fallback_hosts;
+
+	static uint64_t Gcd(uint64_t a, uint64_t b) {
+		while (b) {
+			uint64_t rest = a % b;
+			a = b;
+			b = rest;
+		}
+		return a;
+	}
+
+	static std::vector<Aws::String> Hosts(const AlternatorNodeSnapshot& snapshot) {
+		std::vector<Aws::String> hosts;
+		for (const std::shared_ptr<AlternatorNode>& node : snapshot.nodes) {
+			hosts.push_back(node->host);
+		}
+		return hosts;
+	}
+
+	// Called with _mutex held
+	void Rebuild() {
+		std::shared_ptr<Schedules> schedules = std::make_shared<Schedules>();
+		schedules->primary = Build(_primary_generation, _primary_hosts);
+		schedules->fallback = Build(_fallback_generation, _fallback_hosts);
+		_schedules.Publish(schedules);
+	}
+
+	Schedule Build(uint64_t generation, const std::vector<Aws::String>& hosts) const {
+		Schedule schedule;
+		schedule.generation = generation;
+		schedule.nodes = hosts.size();
+		std::vector<uint64_t> weights;
+		uint64_t total = 0;
+		for (const Aws::String& host : hosts) {
+			auto it = _weights.find(host);
+			weights.push_back(it != _weights.end() ? it->second : _default_weight);
+			total += weights.back();
+		}
+		if (total > MaxCycle) {
+			uint64_t scaled_total = 0;
+			for (uint64_t& weight : weights) {
+				if (weight) {
+					weight = std::max<uint64_t>(1, weight * MaxCycle / total);
+				}
+				scaled_total += weight;
+			}
+			total = scaled_total;
+		}
+		uint64_t divisor = 0;
+		for (uint64_t weight : weights) {
+			divisor = Gcd(divisor, weight);
+		}
+		if (divisor == 0) {
+			return schedule;
+		}
+		for (uint64_t& weight : weights) {
+			weight /= divisor;
+		}
+		total /= divisor;
+		// Every step, each node earns its weight and the richest node is
+		// picked and pays the total
+		std::vector<int64_t> current(weights.size(), 0);
+		schedule.cycle.reserve(total);
+		for (uint64_t i = 0; i < total; ++i) {
+			size_t best = 0;
+			for (size_t j = 0; j < weights.size(); ++j) {
+				current[j] += weights[j];
+				if (current[j] > current[best]) {
+					best = j;
+				}
+			}
+			current[best] -= total;
+			schedule.cycle.push_back(static_cast<uint32_t>(best));
+		}
+		return schedule;
+	}
+};
+
+// Controls connections to nodes, see AlternatorClient::SetConnectionOptions()
+struct AlternatorConnectionOptions {
+	// Requests in flight to a single node beyond which other nodes are
+	// preferred, so that one slow node cannot take up all of the HTTP
+	// client's connections. 0 means no limit.
+	uint32_t max_in_flight_per_node;
+	// Connections to a single node, and requests each of them carries at
+	// once: 1 over HTTP/1.1, the server's stream limit over HTTP/2, see
+	// ClientConfiguration::version. Together they also limit the requests
+	// in flight to a node, so that a node whose connections are all busy
+	// is skipped. 0 connections means no such limit.
+	uint32_t max_connections_per_node;
+	uint32_t streams_per_connection;
+	// Connections opened to a node discovered by the node updater before
+	// it receives requests. 0 sends requests to new nodes right away.
+	uint32_t warm_up_connections;
+
+	AlternatorConnectionOptions()
+		: max_in_flight_per_node(0)
+		, max_connections_per_node(0)
+		, streams_per_connection(1)
+		, warm_up_connections(2) {}
+
+	// 0 if requests in flight to a node are not limited
+	uint32_t InFlightLimit() const {
+		if (max_connections_per_node == 0) {
+			return max_in_flight_per_node;
+		}
+		uint32_t streams = max_connections_per_node * std::max<uint32_t>(streams_per_connection, 1);
+		return max_in_flight_per_node ? std::min(max_in_flight_per_node, streams) : streams;
+	}
+};
+
+// Controls adaptive concurrency limits, see AlternatorClient::EnableConcurrencyLimits()
+struct AlternatorConcurrencyLimitOptions {
+	// Every node starts out allowed initial_limit requests in flight, and
+	// its limit stays between min_limit and max_limit
+	uint32_t initial_limit;
+	uint32_t min_limit;
+	uint32_t max_limit;
+	// A node's limit is multiplied by backoff_ratio whenever a request to
+	// it is throttled, fails at the node, or takes more than
+	// latency_tolerance times the node's average latency (0 to ignore
+	// latency). Otherwise the limit grows by about one per limit's worth of
+	// answered requests, as long as the node is at least half busy.
+	double backoff_ratio;
+	double latency_tolerance;
+	// Time a request waits for a node below its limit when all healthy
+	// nodes are at theirs. It is sent regardless afterwards.
+	std::chrono::milliseconds max_wait;
+
+	AlternatorConcurrencyLimitOptions()
+		: initial_limit(20)
+		, min_limit(1)
+		, max_limit(1000)
+		, backoff_ratio(0.9)
+		, latency_tolerance(2.0)
+		, max_wait(1000) {}
+};
+
+// Controls adaptive refreshes of the node list, see
+// AlternatorClient::EnableAdaptiveRefresh()
+struct AlternatorRefreshOptions {
+	// While the set of nodes stays the same, the interval between refreshes
+	// is multiplied by growth_factor after every refresh, from the interval
+	// given to StartNodeUpdater() up to max_interval
+	std::chrono::milliseconds max_interval;
+	double growth_factor;
+	// Requests which fail because of their node trigger a refresh right
+	// away, but no more than once per min_trigger_interval
+	std::chrono::milliseconds min_trigger_interval;
+
+	AlternatorRefreshOptions()
+		: max_interval(60000)
+		, growth_factor(2)
+		, min_trigger_interval(1000) {}
+};
+
+// Controls compression, see AlternatorClient::EnableCompression()
+struct AlternatorCompressionOptions {
+	// Request bodies of at least min_request_size bytes are gzip-compressed
+	// at the given zlib level, from 1 (fastest) to 9 (smallest)
+	size_t min_request_size;
+	int level;
+	// Whether nodes are asked to compress their responses
+	bool compressed_responses;
+
+	AlternatorCompressionOptions()
+		: min_request_size(4096)
+		, level(1)
+		, compressed_responses(true) {}
+};
+
+// Controls AlternatorClient::ParallelScan()
+struct AlternatorParallelScanOptions {
+	// Segments the table is split into, 0 for four per concurrent request
+	int total_segments;
+	// Scan requests in flight at once, 0 for two per node
+	size_t concurrency;
+	// Pages fetched but not yet passed to the callback, plus pages being
+	// fetched, beyond which no further pages are requested. 0 for twice
+	// the concurrency.
+	size_t max_buffered_pages;
+
+	AlternatorParallelScanOptions()
+		: total_segments(0)
+		, concurrency(0)
+		, max_buffered_pages(0) {}
+};
+
+struct AlternatorScanResult {
+	bool succeeded;
+	// Empty if succeeded
+	Aws::String error;
+	// Items passed to the callback
+	uint64_t items;
+};
+
+struct AlternatorWriteResult {
+	bool succeeded;
+	// Empty if succeeded
+	Aws::String error;
+};
+
+// Controls hedged reads, see AlternatorClient::EnableHedging()
+struct AlternatorHedgingOptions {
+	// Time after which an unanswered read is hedged. If zero, the
+	// percentile below of the first node's recent latency is used instead.
+	std::chrono::microseconds delay;
+	double latency_percentile;
+	// Hedges allowed per read, on average, and in a burst
+	double budget_ratio;
+	uint32_t budget_burst;
+
+	AlternatorHedgingOptions()
+		: delay(0)
+		, latency_percentile(0.99)
+		, budget_ratio(0.05)
+		, budget_burst(10) {}
+};
+
+struct AlternatorNode;
+
+// State shared by the copies of a hedged read
+struct AlternatorHedge : public std::enable_shared_from_this<AlternatorHedge> {
+	std::mutex mutex;
+	std::condition_variable changed;
+	// Set once a copy has answered. The other copy is then cancelled.
+	std::atomic<bool> finished;
+	// The node of the first copy, which the hedge avoids. Set once, before
+	// the hedge is scheduled.
+	std::shared_ptr<AlternatorNode> primary;
+	size_t sent;
+	size_t answered;
+	// Sends the hedge on the executor, returns false if it refused. Called
+	// with mutex held and only while the read is not finished, which keeps
+	// the request it copies alive.
+	std::function<bool(const std::shared_ptr<AlternatorHedge>&)> send;
+
+	AlternatorHedge() : finished(false), sent(1), answered(0) {}
+
+	// Gives up on the read, e.g. when the first copy threw, which cancels
+	// a hedge still on its way and one not sent yet
+	void Abandon() {
+		std::lock_guard<std::mutex> lock(mutex);
+		finished.store(true);
+		changed.notify_all();
+	}
+};
+
+template<typename Outcome>
+struct AlternatorHedgedRead : public AlternatorHedge {
+	Outcome outcome;
+
+	// The first successful answer wins, a failure only if no other copy
+	// is still on its way
+	void Answer(Outcome&& answer) {
+		std::lock_guard<std::mutex> lock(mutex);
+		++answered;
+		if (!finished.load(std::memory_order_relaxed) && (answer.IsSuccess() || answered == sent)) {
+			outcome = std::move(answer);
+			finished.store(true);
+			changed.notify_all();
+		}
+	}
+};
+
+class AlternatorClient;
+class AlternatorTopology;
+
+// The attempt currently in flight on this thread. AWSClient builds, signs,
+// sends and accounts for each attempt synchronously on one thread, so
+// BuildHttpRequest() and the retry strategy's bookkeeping meet here
+// without any shared state.
+struct AlternatorAttempt {
+	const AlternatorClient* client;
+	const Aws::AmazonWebServiceRequest* request;
+	std::shared_ptr<AlternatorNode> node;
+	std::chrono::steady_clock::time_point start;
+	// The node which failed the last attempt of request, avoided by its retry
+	std::shared_ptr<AlternatorNode> failed_node;
+	// The node of the last finished attempt on this thread
+	std::shared_ptr<AlternatorNode> last_node;
+	// Set while this thread sends a copy of a hedged read
+	AlternatorHedge* hedge;
+	bool is_hedge;
+	// Set while this thread sends requests which should go to this node
+	// as long as it is available
+	std::shared_ptr<AlternatorNode> pinned_node;
+	// Whether the body of the current attempt is compressed, and whether
+	// the node refused it, which makes the request retried uncompressed.
+	// Once refused, the request is sent uncompressed until it is done, so
+	// that it gets a single retry for free.
+	bool compressed;
+	bool compression_rejected;
+	bool uncompressed;
+	// Tracing, see AlternatorTracer: the request whose attempts this thread
+	// counts, until one succeeds or it is no longer retried, whether it is
+	// sampled, and whether the current attempt is traced
+	const Aws::AmazonWebServiceRequest* trace_request;
+	bool trace_sampled;
+	bool traced;
+	uint32_t attempt_number;
+	const char* routing;
+	std::chrono::microseconds routing_time;
+	std::chrono::microseconds backoff;
+	std::chrono::steady_clock::time_point ended;
+
+	AlternatorAttempt() : client(nullptr), request(nullptr), hedge(nullptr), is_hedge(false), compressed(false), compression_rejected(false), uncompressed(false),
+		trace_request(nullptr), trace_sampled(false), traced(false), attempt_number(0), routing(""), routing_time(0), backoff(0) {}
+
+	// A copy of a hedged read which lost the race is cancelled, which says
+	// nothing about its node and must not be retried
+	bool IsCancelled() const {
+		return hedge && hedge->finished.load(std::memory_order_relaxed);
+	}
+
+	static AlternatorAttempt& Current() {
+		static thread_local AlternatorAttempt attempt;
+		return attempt;
+	}
+
+	// Returns the node to avoid if this is a retry of a request whose
+	// previous attempt failed because of its node, nullptr otherwise
+	const AlternatorNode* ExcludedNode(const AlternatorClient* owner, const Aws::AmazonWebServiceRequest& retried) const {
+		return client == owner && request == &retried ? failed_node.get() : nullptr;
+	}
+
+	void Begin(const AlternatorClient* owner, const Aws::AmazonWebServiceRequest& sent, const std::shared_ptr<AlternatorNode>& target) {
+		// An attempt which never reached bookkeeping is dropped without a latency sample
+		if (node) {
+			node->in_flight.fetch_sub(1, std::memory_order_relaxed);
+		}
+		if (client != owner || request != &sent) {
+			failed_node.reset();
+			uncompressed = false;
+		}
+		client = owner;
+		request = &sent;
+		node = target;
+		compressed = false;
+		compression_rejected = false;
+		traced = false;
+		node->in_flight.fetch_add(1, std::memory_order_relaxed);
+		start = std::chrono::steady_clock::now();
+	}
+
+	// Defined after AlternatorClient
+	void End(const Aws::Client::HttpResponseOutcome& outcome);
+
+	// Makes next, which must be the next request sent by this thread, avoid
+	// the node the previous request was sent to, as if it were a retry
+	// after a node failure
+	void AvoidLastNode(const Aws::AmazonWebServiceRequest& next) {
+		failed_node = last_node;
+		request = &next;
+	}
+
+	// Called once the request will not be retried. Requests are identified
+	// by address, so forgetting the failed node here keeps it from being
+	// held against an unrelated request which happens to reuse the address.
+	void Finish() {
+		failed_node.reset();
+		request = nullptr;
+	}
+
+	// Errors which say something about the node rather than the request:
+	// no usable response at all, or the node declaring itself unavailable.
+	// Anything else, e.g. a validation error, proves that the node is alive.
+	static bool IsNodeFailure(const Aws::Client::AWSError<Aws::Client::CoreErrors>& error) {
+		switch (error.GetResponseCode()) {
+		case Aws::Http::HttpResponseCode::REQUEST_NOT_MADE:
+		case Aws::Http::HttpResponseCode::REQUEST_TIMEOUT:
+		case Aws::Http::HttpResponseCode::SERVICE_UNAVAILABLE:
+		case Aws::Http::HttpResponseCode::GATEWAY_TIMEOUT:
+			return true;
+		default:
+			return error.GetErrorType() == Aws::Client::CoreErrors::NETWORK_CONNECTION
+				|| error.GetErrorType() == Aws::Client::CoreErrors::REQUEST_TIMEOUT;
+		}
+	}
+
+	// Errors which mean the node has more requests than it can handle
+	static bool IsOverload(const Aws::Client::AWSError<Aws::Client::CoreErrors>& error) {
+		return error.ShouldThrottle() || error.GetResponseCode() == Aws::Http::HttpResponseCode::TOO_MANY_REQUESTS || IsNodeFailure(error);
+	}
+
+	// Errors of a node which cannot read a compressed request body
+	static bool RejectsCompression(const Aws::Client::AWSError<Aws::Client::CoreErrors>& error) {
+		return error.GetResponseCode() == Aws::Http::HttpResponseCode::UNSUPPORTED_MEDIA_TYPE
+			|| error.GetExceptionName().find("SerializationException") != Aws::String::npos;
+	}
+
+	// Node failures where the node never answered. Unlike a 503, which may
+	// mean the whole cluster is overloaded, these say nothing about the
+	// other nodes, so retrying on one of them need not back off.
+	static bool IsUnreachable(const Aws::Client::AWSError<Aws::Client::CoreErrors>& error) {
+		return error.GetResponseCode() == Aws::Http::HttpResponseCode::REQUEST_NOT_MADE
+			|| error.GetErrorType() == Aws::Client::CoreErrors::NETWORK_CONNECTION
+			|| error.GetErrorType() == Aws::Client::CoreErrors::REQUEST_TIMEOUT;
+	}
+};
+
+// Forwards everything to the retry strategy configured by the application.
+// AWSClient reports the outcome of every attempt to its retry strategy,
+// which makes it the one place where AlternatorClient learns how a request
+// it has routed ended.
+// A retry after a node failure is sent to a different node, see
+// AlternatorClient::BuildHttpRequest(), so the first retry after an
+// unreachable node is sent without the usual backoff delay.
+class AlternatorRetryStrategy : public Aws::Client::RetryStrategy {
+protected:
+	std::shared_ptr<Aws::Client::RetryStrategy> _retry_strategy;
+public:
+	explicit AlternatorRetryStrategy(std::shared_ptr<Aws::Client::RetryStrategy> retry_strategy)
+		: _retry_strategy(std::move(retry_strategy)) {}
+
+	virtual bool ShouldRetry(const Aws::Client::AWSError<Aws::Client::CoreErrors>& error, long attemptedRetries) const override {
+		AlternatorAttempt& attempt = AlternatorAttempt::Current();
+		if (attempt.IsCancelled()) {
+			attempt.Finish();
+			attempt.trace_request = nullptr;
+			return false;
+		}
+		// Sent again uncompressed, which the node is known to accept. This
+		// happens at most once per request, see AlternatorAttempt::uncompressed.
+		if (attempt.compression_rejected) {
+			return true;
+		}
+		bool retry = _retry_strategy->ShouldRetry(error, attemptedRetries);
+		if (!retry) {
+			attempt.Finish();
+			attempt.trace_request = nullptr;
+		}
+		return retry;
+	}
+
+	virtual long CalculateDelayBeforeNextRetry(const Aws::Client::AWSError<Aws::Client::CoreErrors>& error, long attemptedRetries) const override {
+		if (AlternatorAttempt::Current().compression_rejected) {
+			AlternatorAttempt::Current().compression_rejected = false;
+			return 0;
+		}
+		if (attemptedRetries == 0 && AlternatorAttempt::IsUnreachable(error) && AlternatorAttempt::Current().failed_node) {
+			return 0;
+		}
+		return _retry_strategy->CalculateDelayBeforeNextRetry(error, attemptedRetries);
+	}
+
+	virtual bool HasSendToken() override {
+		return _retry_strategy->HasSendToken();
+	}
+
+	virtual void GetSendToken() override {
+		_retry_strategy->GetSendToken();
+	}
+
+	virtual long GetMaxAttempts() const override {
+		return _retry_strategy->GetMaxAttempts();
+	}
+
+	virtual void RequestBookkeeping(const Aws::Client::HttpResponseOutcome& httpResponseOutcome) override {
+		AlternatorAttempt::Current().End(httpResponseOutcome);
+		_retry_strategy->RequestBookkeeping(httpResponseOutcome);
+	}
+
+	virtual void RequestBookkeeping(const Aws::Client::HttpResponseOutcome& httpResponseOutcome, const Aws::Client::AWSError<Aws::Client::CoreErrors>& lastError) override {
+		AlternatorAttempt::Current().End(httpResponseOutcome);
+		_retry_strategy->RequestBookkeeping(httpResponseOutcome, lastError);
+	}
+};
+
+// A point-in-time copy of the counters of a node or of node list refreshes
+struct AlternatorRequestMetrics {
+	uint64_t requests;
+	uint64_t errors;
+	uint64_t node_failures;
+	std::chrono::microseconds latency_sum;
+	// Requests per latency bucket, see AlternatorLatencyBuckets::Bounds()
+	uint64_t latency_buckets[AlternatorLatencyBuckets::Count];
+
+	explicit AlternatorRequestMetrics(const AlternatorRequestCounters& counters)
+		: requests(counters.Sum(AlternatorRequestCounters::REQUESTS))
+		, errors(counters.Sum(AlternatorRequestCounters::ERRORS))
+		, node_failures(counters.Sum(AlternatorRequestCounters::NODE_FAILURES))
+		, latency_sum(counters.Sum(AlternatorRequestCounters::LATENCY_SUM_US)) {
+			for (size_t i = 0; i < AlternatorLatencyBuckets::Count; ++i) {
+				latency_buckets[i] = counters.Sum(AlternatorRequestCounters::LATENCY_BUCKETS + i);
+			}
+		}
+};
+
+struct AlternatorNodeMetrics {
+	Aws::String host;
+	// Whether requests are routed to the node, or it is only a fallback
+	bool preferred;
+	bool quarantined;
+	uint32_t in_flight;
+	// 0 unless concurrency limits are enabled and have adapted
+	uint32_t concurrency_limit;
+	// Negative unless the node reports its load
+	double reported_load;
+	AlternatorRequestMetrics requests;
+
+	AlternatorNodeMetrics(const AlternatorNode& node, bool preferred)
+		: host(node.host)
+		, preferred(preferred)
+		, quarantined(node.quarantined.load(std::memory_order_relaxed))
+		, in_flight(node.in_flight.load(std::memory_order_relaxed))
+		, concurrency_limit(static_cast<uint32_t>(node.concurrency_limit.load(std::memory_order_relaxed)))
+		, reported_load(node.reported_load.load(std::memory_order_relaxed))
+		, requests(node.counters) {}
+};
+
+// See AlternatorClient::GetMetrics()
+struct AlternatorMetrics {
+	std::vector<AlternatorNodeMetrics> nodes;
+	// Changes of the set of nodes, counting the initial node list as one
+	uint64_t topology_changes;
+	std::chrono::system_clock::time_point last_topology_change;
+	// Node list refreshes by the update thread, whose errors are refreshes
+	// where no node answered
+	AlternatorRequestMetrics refreshes;
+	uint64_t hedges;
+
+	explicit AlternatorMetrics(const AlternatorRequestCounters& refresh_counters)
+		: topology_changes(0)
+		, refreshes(refresh_counters)
+		, hedges(0) {}
+
+	// The metrics in Prometheus' text exposition format
+	Aws::String ToPrometheus(const Aws::String& prefix = "alternator_client") const {
+		Aws::OStringStream out;
+		WriteNodeCounter(out, prefix + "_requests_total", "counter", [] (const AlternatorNodeMetrics& node) { return node.requests.requests; });
+		WriteNodeCounter(out, prefix + "_errors_total", "counter", [] (const AlternatorNodeMetrics& node) { return node.requests.errors; });
+		WriteNodeCounter(out, prefix + "_node_failures_total", "counter", [] (const AlternatorNodeMetrics& node) { return node.requests.node_failures; });
+		WriteNodeCounter(out, prefix + "_in_flight", "gauge", [] (const AlternatorNodeMetrics& node) { return static_cast<uint64_t>(node.in_flight); });
+		WriteNodeCounter(out, prefix + "_concurrency_limit", "gauge", [] (const AlternatorNodeMetrics& node) { return static_cast<uint64_t>(node.concurrency_limit); });
+		WriteNodeCounter(out, prefix + "_quarantined", "gauge", [] (const AlternatorNodeMetrics& node) { return static_cast<uint64_t>(node.quarantined); });
+		out << "# TYPE " << prefix << "_request_latency_seconds histogram\n";
+		for (const AlternatorNodeMetrics& node : nodes) {
+			WriteHistogram(out, prefix + "_request_latency_seconds", "node=\"" + node.host + "\",", node.requests);
+		}
+		out << "# TYPE " << prefix << "_topology_changes_total counter\n" << prefix << "_topology_changes_total " << topology_changes << "\n";
+		out << "# TYPE " << prefix << "_last_topology_change_timestamp_seconds gauge\n" << prefix << "_last_topology_change_timestamp_seconds "
+			<< std::chrono::duration_cast<std::chrono::seconds>(last_topology_change.time_since_epoch()).count() << "\n";
+		out << "# TYPE " << prefix << "_node_list_refreshes_total counter\n" << prefix << "_node_list_refreshes_total " << refreshes.requests << "\n";
+		out << "# TYPE " << prefix << "_node_list_refresh_failures_total counter\n" << prefix << "_node_list_refresh_failures_total " << refreshes.errors << "\n";
+		out << "# TYPE " << prefix << "_node_list_refresh_latency_seconds histogram\n";
+		WriteHistogram(out, prefix + "_node_list_refresh_latency_seconds", "", refreshes);
+		out << "# TYPE " << prefix << "_hedges_total counter\n" << prefix << "_hedges_total " << hedges << "\n";
+		return out.str();
+	}
+
+protected:
+	template<typename Value>
+	void WriteNodeCounter(Aws::OStringStream& out, const Aws::String& name, const char* type, Value value) const {
+		out << "# TYPE " << name << " " << type << "\n";
+		for (const AlternatorNodeMetrics& node : nodes) {
+			out << name << "{node=\"" << node.host << "\"} " << value(node) << "\n";
+		}
+	}
+
+	static void WriteHistogram(Aws::OStringStream& out, const Aws::String& name, const Aws::String& labels, const AlternatorRequestMetrics& metrics) {
+		uint64_t cumulative = 0;
+		for (size_t i = 0; i < AlternatorLatencyBuckets::Count; ++i) {
+			cumulative += metrics.latency_buckets[i];
+			out << name << "_bucket{" << labels << "le=\"";
+			if (i < AlternatorLatencyBuckets::Count - 1) {
+				out << AlternatorLatencyBuckets::Bounds()[i].count() / 1e6;
+			} else {
+				out << "+Inf";
+			}
+			out << "\"} " << cumulative << "\n";
+		}
+		Aws::String selector = labels.empty() ? Aws::String() : "{" + labels.substr(0, labels.size() - 1) + "}";
+		out << name << "_sum" << selector << " " << metrics.latency_sum.count() / 1e6 << "\n";
+		out << name << "_count" << selector << " " << metrics.requests << "\n";
+	}
+};
+
+// Nodes which joined and left the node list with one of its changes.
+// Nodes which stay keep their AlternatorNode object, with its statistics
+// and health state.
+struct AlternatorNodeChanges {
+	std::vector<std::shared_ptr<AlternatorNode>> added;
+	std::vector<std::shared_ptr<AlternatorNode>> removed;
+};
+
+// One attempt of a request sampled by an AlternatorTracer
+struct AlternatorAttemptTrace {
+	// The request's name, e.g. "GetItem"
+	const char* operation;
+	const AlternatorNode* node;
+	// AlternatorNodeSelectionPolicy::Name() of the client's policy
+	const char* policy;
+	// How the node was chosen: "policy", "pinned" (e.g. by ParallelScan()),
+	// "token-aware", "key-affinity", or "capacity-wait" if every node was
+	// at its concurrency limit
+	const char* routing;
+	// 0 for the first attempt, and 1 and on for retries
+	uint32_t attempt;
+	bool hedge;
+	bool error;
+	bool node_failure;
+	Aws::Http::HttpResponseCode response_code;
+	// The exception name of an error, empty if there is none
+	const char* error_type;
+	// When the attempt was sent, for the span's start
+	std::chrono::system_clock::time_point start;
+	// Time spent choosing the node, including any wait for capacity, the
+	// delay since the previous attempt ended, 0 for the first attempt, and
+	// the time from choosing the node to receiving the response
+	std::chrono::microseconds routing_time;
+	std::chrono::microseconds backoff;
+	std::chrono::microseconds latency;
+
+	// Calls visit(name, value) for each attribute of the attempt's span,
+	// named after OpenTelemetry's semantic conventions where one applies,
+	// with a value which is a const char*, an int64_t or a bool
+	template<typename Visitor>
+	void ForEachAttribute(Visitor&& visit) const {
+		visit("rpc.system", "aws-api");
+		visit("rpc.service", "DynamoDB");
+		visit("rpc.method", operation);
+		visit("server.address", node->host.c_str());
+		visit("server.port", static_cast<int64_t>(node->port));
+		if (response_code != Aws::Http::HttpResponseCode::REQUEST_NOT_MADE) {
+			visit("http.response.status_code", static_cast<int64_t>(response_code));
+		}
+		if (attempt > 0) {
+			visit("http.request.resend_count", static_cast<int64_t>(attempt));
+		}
+		if (error) {
+			visit("error.type", *error_type ? error_type : "_OTHER");
+		}
+		visit("alternator.policy", policy);
+		visit("alternator.routing", routing);
+		visit("alternator.hedge", hedge);
+		visit("alternator.node_failure", node_failure);
+		visit("alternator.routing_time_us", static_cast<int64_t>(routing_time.count()));
+		visit("alternator.backoff_us", static_cast<int64_t>(backoff.count()));
+	}
+};
+
+// Receives a trace of every attempt of the requests it samples, e.g. to
+// record them as OpenTelemetry spans. ShouldTrace() is called once per
+// request, before its first attempt, on the thread sending it. By default
+// it samples sample_ratio of the requests at random, and a tracer can
+// instead follow the sampling decision of the application's current span.
+// A request which is not sampled costs that call and nothing else. Called
+// concurrently, so it must be thread-safe.
+class AlternatorTracer {
+public:
+	explicit AlternatorTracer(double sample_ratio = 0.01) : _sample_ratio(sample_ratio) {}
+	virtual ~AlternatorTracer() {}
+
+	virtual bool ShouldTrace(const Aws::AmazonWebServiceRequest&) {
+		static thread_local std::minstd_rand rng(std::random_device{}());
+		return rng() - std::minstd_rand::min() < _sample_ratio * (std::minstd_rand::max() - std::minstd_rand::min() + 1.0);
+	}
+
+	virtual void AttemptFinished(const AlternatorAttemptTrace& trace) = 0;
+
+protected:
+	double _sample_ratio;
+};
+
+// Receives events as they happen, e.g. to feed a metrics library. Called on
+// the threads sending requests and refreshing the node list, so it must be
+// thread-safe and fast.
+class AlternatorMetricsObserver {
+public:
+	virtual ~AlternatorMetricsObserver() {}
+	// Called for every attempt, i.e. once per retry, with whether it
+	// failed and whether it failed because of the node
+	virtual void AttemptFinished(const AlternatorNode&, bool /* error */, bool /* node_failure */, std::chrono::microseconds) {}
+	// Called whenever a different node list is published, and also with
+	// the nodes which joined or left it, unless nodes only moved between
+	// the preferred rack and the fallback
+	virtual void NodesChanged(const AlternatorNodeSnapshot&) {}
+	virtual void MembershipChanged(const AlternatorNodeSnapshot&, const AlternatorNodeChanges&) {}
+	virtual void RefreshFinished(bool /* succeeded */, std::chrono::microseconds) {}
+};
+
+class AlternatorClient : public Aws::DynamoDB::DynamoDBClient {
+protected:
+	typedef Aws::Map<Aws::String, std::shared_ptr<const AlternatorTableRing>> TableRings;
+
+	Aws::String _protocol;
+	Aws::String _port;
+	Aws::Http::Scheme _scheme;
+	uint16_t _port_number;
+	Aws::String _datacenter;
+	Aws::String _rack;
+	std::shared_ptr<AlternatorNodeSelectionPolicy> _selection_policy;
+	AlternatorPublished<AlternatorNodeSnapshot> _nodes;
+	mutable std::atomic<size_t> _updater_idx;
+	std::unique_ptr<std::thread> _node_updater;
+
+	// Token-aware routing, disabled as long as the REST API port is 0
+	uint16_t _rest_api_port;
+	bool _key_affinity;
+	mutable AlternatorPublished<TableRings> _table_rings;
+	// Serializes updates to _table_rings
+	mutable std::mutex _table_rings_mutex;
+	// Bumped whenever the set of nodes changes, which makes rings outdated
+	std::atomic<uint64_t> _topology_epoch;
+
+	AlternatorHealthCheckOptions _health_check_options;
+	AlternatorConnectionOptions _connection_options;
+
+	bool _concurrency_limits;
+	AlternatorConcurrencyLimitOptions _concurrency_limit_options;
+	mutable std::mutex _capacity_mutex;
+	// Notified when a request finishes while requests wait for capacity
+	mutable std::condition_variable _capacity;
+	mutable std::atomic<uint32_t> _capacity_waiters;
+
+	bool _hedging;
+	AlternatorHedgingOptions _hedging_options;
+	// Hedges waiting for their delay to pass, sent by the _hedge_timer thread
+	struct PendingHedge {
+		std::chrono::steady_clock::time_point deadline;
+		std::shared_ptr<AlternatorHedge> hedge;
+
+		// Orders the queue by the earliest deadline first
+		bool operator<(const PendingHedge& other) const {
+			return deadline > other.deadline;
+		}
+	};
+	mutable std::priority_queue<PendingHedge> _pending_hedges;
+	mutable std::mutex _pending_hedges_mutex;
+	mutable std::condition_variable _pending_hedges_changed;
+	bool _hedge_timer_stopping;
+	std::unique_ptr<std::thread> _hedge_timer;
+	// Token bucket limiting the hedge rate, in thousandths of a hedge
+	mutable std::atomic<int64_t> _hedge_budget;
+	mutable std::atomic<uint64_t> _hedges;
+
+	bool _compression;
+	AlternatorCompressionOptions _compression_options;
+
+	// Lowercase, as the HTTP client stores response headers, empty if none
+	Aws::String _load_header;
+
+	AlternatorRequestCounters _refresh_counters;
+	// system_clock time of the last change of the node list, in milliseconds
+	std::atomic<int64_t> _last_topology_change_ms;
+	std::shared_ptr<AlternatorMetricsObserver> _metrics_observer;
+	std::shared_ptr<AlternatorTracer> _tracer;
+	// Whether the node list came from a node, rather than from the
+	// constructor or the topology cache, which StartNodeUpdater() then
+	// refreshes right away
+	bool _nodes_fetched;
+	Aws::String _topology_cache_path;
+	std::chrono::seconds _topology_cache_max_age;
+	std::chrono::steady_clock::time_point _topology_cache_saved;
+	// Used for node list fetches and health probes, with short timeouts of its own
+	std::shared_ptr<Aws::Http::HttpClient> _control_http_client;
+
+	std::shared_ptr<Aws::Utils::Threading::Executor> _executor;
+	mutable std::mutex _background_tasks_mutex;
+	mutable std::condition_variable _background_tasks_done;
+	// Wakes up background tasks waiting in WaitForShutdown(), and the update
+	// thread waiting in WaitForRefresh()
+	mutable std::condition_variable _shutdown;
+	mutable size_t _background_tasks;
+	bool _shutting_down;
+	mutable bool _refresh_requested;
+
+	bool _adaptive_refresh;
+	AlternatorRefreshOptions _refresh_options;
+	// steady_clock time of the last RequestRefresh() let through, in milliseconds
+	mutable std::atomic<int64_t> _last_refresh_request_ms;
+
+	// The nodes given to the constructor, which identify the cluster and
+	// are asked for the node list when none of the current nodes answers
+	std::vector<Aws::String> _seeds;
+	std::shared_ptr<AlternatorTopology> _topology;
+
+	friend struct AlternatorAttempt;
+	friend class AlternatorBatchWriter;
+	friend class AlternatorTopology;
+public:
+	// With a datacenter and/or rack given, requests are only routed to nodes
+	// of that datacenter, and to nodes of that rack as long as any of them
+	// is healthy. Without a datacenter, the datacenter of the contacted node
+	// is used.
+	AlternatorClient(Aws::String protocol, Aws::String control_addr, Aws::String port,
+			const Aws::Client::ClientConfiguration &clientConfiguration = Aws::Client::ClientConfiguration(),
+			Aws::String datacenter = "", Aws::String rack = "")
+		: AlternatorClient(protocol, std::vector<Aws::String>(1, control_addr), port, clientConfiguration, datacenter, rack) {
+			FetchLocalNodes();
+		}
+
+	// Routes requests to the given nodes without contacting any of them
+	// first. The node list is only refreshed by StartNodeUpdater(), from
+	// these nodes, which should then belong to the given datacenter and rack.
+	AlternatorClient(Aws::String protocol, const std::vector<Aws::String>& nodes, Aws::String port,
+			const Aws::Client::ClientConfiguration &clientConfiguration = Aws::Client::ClientConfiguration(),
+			Aws::String datacenter = "", Aws::String rack = "")
+		: Aws::DynamoDB::DynamoDBClient(WithAlternatorRetryStrategy(clientConfiguration))
+		, _protocol(protocol)
+		, _port(port)
+		, _scheme(Aws::Http::SchemeMapper::FromString(protocol.c_str()))
+		, _port_number(static_cast<uint16_t>(std::stoul(port.c_str())))
+		, _datacenter(datacenter)
+		, _rack(rack)
+		, _selection_policy(std::make_shared<AlternatorRoundRobinPolicy>())
+		, _updater_idx(0)
+		, _rest_api_port(0)
+		, _key_affinity(false)
+		, _topology_epoch(0)
+		, _concurrency_limits(false)
+		, _capacity_waiters(0)
+		, _hedging(false)
+		, _hedge_timer_stopping(false)
+		, _hedge_budget(0)
+		, _hedges(0)
+		, _compression(false)
+		, _last_topology_change_ms(0)
+		, _nodes_fetched(false)
+		, _topology_cache_max_age(0)
+		, _control_http_client(Aws::Http::CreateHttpClient(ControlConfiguration(clientConfiguration)))
+		, _executor(clientConfiguration.executor)
+		, _background_tasks(0)
+		, _shutting_down(false)
+		, _refresh_requested(false)
+		, _adaptive_refresh(false)
+		, _last_refresh_request_ms(std::numeric_limits<int64_t>::min() / 2) {
+			if (!_executor) {
+				_executor = std::make_shared<Aws::Utils::Threading::DefaultExecutor>();
+			}
+			if (nodes.empty()) {
+				throw std::invalid_argument("AlternatorClient needs at least one node");
+			}
+			_seeds = nodes;
+			PublishNodes(nodes, std::vector<Aws::String>(), false);
+		}
+
+	virtual ~AlternatorClient() {
+		LeaveTopology();
+		if (_hedge_timer) {
+			{
+				std::lock_guard<std::mutex> lock(_pending_hedges_mutex);
+				_hedge_timer_stopping = true;
+			}
+			_pending_hedges_changed.notify_all();
+			_hedge_timer->join();
+		}
+		{
+			std::lock_guard<std::mutex> lock(_background_tasks_mutex);
+			_shutting_down = true;
+			_shutdown.notify_all();
+		}
+		if (_node_updater) {
+			_node_updater->join();
+		}
+		std::unique_lock<std::mutex> lock(_background_tasks_mutex);
+		_background_tasks_done.wait(lock, [this] { return _background_tasks == 0; });
+	}
+
+	virtual void BuildHttpRequest(const Aws::AmazonWebServiceRequest &request, const std::shared_ptr< Aws::Http::HttpRequest > &httpRequest) const override {
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		AlternatorAttempt& attempt = AlternatorAttempt::Current();
+		const AlternatorNode* exclude = attempt.ExcludedNode(this, request);
+		if (!exclude && attempt.is_hedge) {
+			exclude = attempt.hedge->primary.get();
+		}
+		const std::shared_ptr<AlternatorNode>* replica = nullptr;
+		const char* routing = "policy";
+		if (attempt.pinned_node && IsAvailable(*attempt.pinned_node, exclude)) {
+			replica = &attempt.pinned_node;
+			routing = "pinned";
+		} else if (_rest_api_port || _key_affinity) {
+			replica = PickReplica(request, now, exclude, routing);
+		}
+		const std::shared_ptr<AlternatorNode>* picked = replica ? replica : &PickNode(exclude);
+		if (_concurrency_limits && !IsAvailable(**picked, exclude)) {
+			picked = &WaitForCapacity(exclude);
+			routing = "capacity-wait";
+		}
+		attempt.Begin(this, request, *picked);
+		// picked is only valid until the node list is read again, the attempt's copy for as long as it runs
+		const std::shared_ptr<AlternatorNode>& node = attempt.node;
+		if (_tracer) {
+			StartTrace(attempt, request, now, routing);
+		}
+		if (attempt.hedge && !attempt.is_hedge) {
+			ScheduleHedge(*attempt.hedge, node);
+		}
+		Aws::Http::URI& uri = httpRequest->GetUri();
+		uri.SetScheme(node->scheme);
+		uri.SetAuthority(node->host);
+		uri.SetPort(node->port);
+		Aws::DynamoDB::DynamoDBClient::BuildHttpRequest(request, httpRequest);
+		if (attempt.hedge) {
+			// The copy which loses the race is cancelled
+			const AlternatorHedge* hedge = attempt.hedge;
+			Aws::Http::ContinueRequestHandler handler = httpRequest->GetContinueRequestHandler();
+			httpRequest->SetContinueRequestHandle([hedge, handler](const Aws::Http::HttpRequest* http_request) {
+				return !hedge->finished.load(std::memory_order_relaxed) && (!handler || handler(http_request));
+			});
+		}
+#ifdef ALTERNATOR_ZLIB
+		if (_compression) {
+			Compress(*httpRequest, *node, attempt);
+		}
+#endif
+	}
+
+	void FetchLocalNodes() {
+		std::vector<Aws::String> nodes;
+		std::vector<Aws::String> fallback_nodes;
+		if (FetchLocalNodes(GetURIForUpdates(), nodes, fallback_nodes)) {
+			_nodes_fetched = true;
+			PublishNodes(nodes, fallback_nodes, false);
+		}
+	}
+
+	// Routes requests to the nodes saved to the file at path by an earlier
+	// run, if that run used the same protocol, port, datacenter and rack,
+	// and saved them no more than max_age ago (0 for any age). From then on
+	// the node list is saved there whenever it changes, or at least every
+	// max_age / 2. Returns whether nodes were loaded. Combined with the
+	// constructor taking a list of seed nodes, a process starts routing
+	// requests without waiting for any node, and StartNodeUpdater()
+	// refreshes the list in the background. Must be called before
+	// StartNodeUpdater().
+	bool UseTopologyCache(const Aws::String& path, std::chrono::seconds max_age = std::chrono::hours(24)) {
+		std::vector<Aws::String> nodes;
+		std::vector<Aws::String> fallback_nodes;
+		bool loaded = LoadTopologyCache(path, max_age, nodes, fallback_nodes);
+		if (loaded) {
+			PublishNodes(nodes, fallback_nodes, false);
+		}
+		_topology_cache_path = path;
+		_topology_cache_max_age = max_age;
+		return loaded;
+	}
+
+	// Fetches the node list from the node at uri, split into the nodes
+	// requests are routed to and their fallback. Returns false if the node
+	// knows of no nodes at all.
+	bool FetchLocalNodes(Aws::Http::URI uri, std::vector<Aws::String>& nodes, std::vector<Aws::String>& fallback_nodes) const {
+		if (!_datacenter.empty()) {
+			uri.AddQueryStringParameter("dc", _datacenter);
+		}
+		std::vector<Aws::String> datacenter_nodes = FetchNodeList(uri);
+		std::vector<Aws::String> rack_nodes;
+		if (!_rack.empty()) {
+			uri.AddQueryStringParameter("rack", _rack);
+			rack_nodes = FetchNodeList(uri);
+		}
+		if (datacenter_nodes.empty()) {
+			return false;
+		}
+		if (rack_nodes.empty()) {
+			nodes = std::move(datacenter_nodes);
+		} else {
+			for (const Aws::String& host : datacenter_nodes) {
+				if (std::find(rack_nodes.begin(), rack_nodes.end(), host) == rack_nodes.end()) {
+					fallback_nodes.push_back(host);
+				}
+			}
+			nodes = std::move(rack_nodes);
+		}
+		return true;
+	}
+
+	Aws::Http::URI NextNode() const {
+		return PickNode()->uri;
+	}
+
+	// Replaces the policy used to pick a node for each request, which is
+	// round-robin by default. Must be called before the client starts
+	// sending requests.
+	void SetNodeSelectionPolicy(std::shared_ptr<AlternatorNodeSelectionPolicy> policy) {
+		policy->NodesChanged(*CurrentNodes());
+		_selection_policy = std::move(policy);
+	}
+
+	// Sends GetItem, PutItem, UpdateItem and DeleteItem requests straight to
+	// a replica owning the item's partition, which saves the coordinator a
+	// hop to the replica. The key schema of each table is learned with
+	// DescribeTable and its token ring from Scylla's REST API, in the
+	// background - until then, and for tables with a numeric partition key,
+	// requests are routed as usual. Must be called before the client starts
+	// sending requests.
+	void EnableTokenAwareRouting(uint16_t rest_api_port = 10000) {
+		_rest_api_port = rest_api_port;
+	}
+
+	// Sends GetItem, PutItem, UpdateItem and DeleteItem requests for the
+	// same partition key to the same node, chosen among the preferred nodes
+	// by rendezvous hashing, which keeps each node's row cache warm with
+	// its share of the keys. Needs no REST API: only the key schema is
+	// learned, with DescribeTable in the background. When a node leaves,
+	// becomes unhealthy or is saturated, only its keys move to other nodes.
+	// Token-aware routing, if also enabled, takes precedence for the tables
+	// whose ring is known. Must be called before the client starts sending
+	// requests.
+	void EnableKeyAffinity() {
+		_key_affinity = true;
+	}
+
+	// A node is quarantined after options.quarantine_threshold consecutive
+	// failures which point at the node itself. It then receives no requests
+	// until a probe of its health check endpoint succeeds. Must be called
+	// before the client starts sending requests.
+	void SetHealthCheckOptions(const AlternatorHealthCheckOptions& options) {
+		_health_check_options = options;
+	}
+
+	// When enabled, every node is allowed a number of requests in flight
+	// which shrinks when the node throttles, fails or slows down and grows
+	// back while it keeps up. Nodes at their limit are skipped, and when
+	// all of them are, requests wait for one to catch up. Must be called
+	// before the client starts sending requests.
+	void EnableConcurrencyLimits(const AlternatorConcurrencyLimitOptions& options = AlternatorConcurrencyLimitOptions()) {
+		_concurrency_limit_options = options;
+		_concurrency_limits = true;
+	}
+
+	// When enabled, a GetItem, BatchGetItem or Query request which is not
+	// answered within options.delay is sent again, to another node, and the
+	// first answer is returned while the other copy is cancelled. The first
+	// copy is sent on the calling thread, and only hedges which are actually
+	// sent run on the executor from the client configuration, started by a
+	// timer thread of the client's own. Must be called before the client
+	// starts sending requests.
+	void EnableHedging(const AlternatorHedgingOptions& options = AlternatorHedgingOptions()) {
+		_hedging_options = options;
+		_hedge_budget.store(static_cast<int64_t>(options.budget_burst) * 1000);
+		_hedging = true;
+		if (!_hedge_timer) {
+			_hedge_timer = std::unique_ptr<std::thread>(new std::thread([this] { RunHedgeTimer(); }));
+		}
+	}
+
+	virtual Aws::DynamoDB::Model::GetItemOutcome GetItem(const Aws::DynamoDB::Model::GetItemRequest& request) const override {
+		return HedgedRead<Aws::DynamoDB::Model::GetItemOutcome>(request, [this](const Aws::DynamoDB::Model::GetItemRequest& r) {
+			return Aws::DynamoDB::DynamoDBClient::GetItem(r);
+		});
+	}
+
+	virtual Aws::DynamoDB::Model::BatchGetItemOutcome BatchGetItem(const Aws::DynamoDB::Model::BatchGetItemRequest& request) const override {
+		return HedgedRead<Aws::DynamoDB::Model::BatchGetItemOutcome>(request, [this](const Aws::DynamoDB::Model::BatchGetItemRequest& r) {
+			return Aws::DynamoDB::DynamoDBClient::BatchGetItem(r);
+		});
+	}
+
+	virtual Aws::DynamoDB::Model::QueryOutcome Query(const Aws::DynamoDB::Model::QueryRequest& request) const override {
+		return HedgedRead<Aws::DynamoDB::Model::QueryOutcome>(request, [this](const Aws::DynamoDB::Model::QueryRequest& r) {
+			return Aws::DynamoDB::DynamoDBClient::Query(r);
+		});
+	}
+
+#ifdef ALTERNATOR_ZLIB
+	// When enabled, request bodies of at least options.min_request_size
+	// bytes are gzip-compressed, unless that does not make them smaller,
+	// and nodes are asked to compress their responses. A node which refuses
+	// a compressed request is sent uncompressed requests from then on,
+	// starting with an immediate retry of that request, which is not
+	// compressed again before it is done. Responses marked with
+	// Content-Encoding: gzip are decompressed into the client's own buffer,
+	// as with ScanItems(). Requests with a response stream factory of their
+	// own get uncompressed responses.
+	// Must be called before the client starts sending requests.
+	void EnableCompression(const AlternatorCompressionOptions& options = AlternatorCompressionOptions()) {
+		_compression_options = options;
+		_compression = true;
+	}
+#endif
+
+	// Reads the load of a node from this header of its responses, e.g. as
+	// added by a proxy in front of it, for AlternatorLoadAwarePolicy. The
+	// value is the fraction of the node's capacity in use, 0 when idle.
+	// Must be called before the client starts sending requests.
+	void SetLoadHeader(const Aws::String& name) {
+		_load_header.clear();
+		for (char c : name) {
+			_load_header.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+		}
+	}
+
+	// Metrics are always collected, the observer is optional. Must be called
+	// before the client starts sending requests.
+	void SetMetricsObserver(std::shared_ptr<AlternatorMetricsObserver> observer) {
+		_metrics_observer = std::move(observer);
+	}
+
+	// Traces the requests sampled by the tracer, with one trace per attempt.
+	// Without a tracer no time is spent on tracing. Must be called before
+	// the client starts sending requests.
+	void SetTracer(std::shared_ptr<AlternatorTracer> tracer) {
+		_tracer = std::move(tracer);
+	}
+
+	AlternatorMetrics GetMetrics() const {
+		AlternatorMetrics metrics(_refresh_counters);
+		std::shared_ptr<const AlternatorNodeSnapshot> snapshot = CurrentNodes();
+		for (const std::shared_ptr<AlternatorNode>& node : snapshot->nodes) {
+			metrics.nodes.emplace_back(*node, true);
+		}
+		if (snapshot->fallback) {
+			for (const std::shared_ptr<AlternatorNode>& node : snapshot->fallback->nodes) {
+				metrics.nodes.emplace_back(*node, false);
+			}
+		}
+		metrics.topology_changes = _topology_epoch.load();
+		metrics.last_topology_change = std::chrono::system_clock::time_point(std::chrono::milliseconds(_last_topology_change_ms.load()));
+		metrics.hedges = _hedges.load(std::memory_order_relaxed);
+		return metrics;
+	}
+
+	// Must be called before the client starts sending requests
+	void SetConnectionOptions(const AlternatorConnectionOptions& options) {
+		_connection_options = options;
+	}
+
+	// Scans the whole table, or the part of it selected by request's
+	// filter, in options.total_segments segments at once. Segments are
+	// spread over the nodes, and each segment's next page is requested as
+	// soon as a page arrives, as long as no more than max_buffered_pages
+	// are buffered. Items are passed to the callback on the calling thread,
+	// in no particular order; the scan stops early if it returns false.
+	AlternatorScanResult ParallelScan(const Aws::DynamoDB::Model::ScanRequest& request,
+			const std::function<bool(const Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue>&)>& callback,
+			const AlternatorParallelScanOptions& options = AlternatorParallelScanOptions()) const {
+		std::shared_ptr<const AlternatorNodeSnapshot> snapshot = CurrentNodes();
+		if (snapshot->nodes.empty()) {
+			return AlternatorScanResult{false, "No Alternator nodes are known", 0};
+		}
+		std::shared_ptr<ParallelScanState> scan = std::make_shared<ParallelScanState>();
+		scan->nodes = snapshot->nodes;
+		scan->concurrency = options.concurrency ? options.concurrency : 2 * scan->nodes.size();
+		scan->total_segments = options.total_segments ? options.total_segments : static_cast<int>(4 * scan->concurrency);
+		scan->max_buffered_pages = options.max_buffered_pages ? options.max_buffered_pages : 2 * scan->concurrency;
+		for (int segment = 0; segment < scan->total_segments; ++segment) {
+			scan->ready.push_back(std::make_pair(segment, Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue>()));
+		}
+		AlternatorScanResult result{true, Aws::String(), 0};
+		std::unique_lock<std::mutex> lock(scan->mutex);
+		RequestPages(scan, request);
+		for (;;) {
+			scan->changed.wait(lock, [&scan] { return !scan->pages.empty() || scan->failed || scan->finished_segments == scan->total_segments; });
+			if (scan->pages.empty()) {
+				break;
+			}
+			Aws::DynamoDB::Model::ScanResult page = std::move(scan->pages.front());
+			scan->pages.pop_front();
+			RequestPages(scan, request);
+			lock.unlock();
+			bool keep_going = true;
+			for (const auto& item : page.GetItems()) {
+				++result.items;
+				if (!callback(item)) {
+					keep_going = false;
+					break;
+				}
+			}
+			lock.lock();
+			if (!keep_going) {
+				break;
+			}
+		}
+		if (scan->failed) {
+			result.succeeded = false;
+			result.error = scan->error;
+		}
+		// Requests in flight refer to this client, and are waited for
+		scan->failed = true;
+		scan->changed.wait(lock, [&scan] { return scan->fetching == 0; });
+		return result;
+	}
+
+	// Like Scan() and Query(), but reads the items of each page straight
+	// from the response body and passes them to callback one at a time,
+	// instead of building a JSON document and a result holding the whole
+	// page. Pages are requested until the last one or until callback
+	// returns false.
+	AlternatorScanResult ScanItems(const Aws::DynamoDB::Model::ScanRequest& request,
+			const std::function<bool(const Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue>&)>& callback) const {
+		return StreamItems(request, callback);
+	}
+
+	AlternatorScanResult QueryItems(const Aws::DynamoDB::Model::QueryRequest& request,
+			const std::function<bool(const Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue>&)>& callback) const {
+		return StreamItems(request, callback);
+	}
+
+	// Sends the PutItem or BatchWriteItem request built by writer, which
+	// is finished with End(). Items of a batch which Alternator leaves
+	// unprocessed are resent, to a different node, up to
+	// max_unprocessed_retries times with a delay starting at backoff and
+	// doubling every time, before the write fails.
+	AlternatorWriteResult Write(const AlternatorItemWriter& writer, uint32_t max_unprocessed_retries = 5,
+			std::chrono::milliseconds backoff = std::chrono::milliseconds(20)) const {
+		std::shared_ptr<const AlternatorNodeSnapshot> snapshot = CurrentNodes();
+		if (snapshot->nodes.empty()) {
+			return AlternatorWriteResult{false, "No Alternator nodes are known"};
+		}
+		// BuildHttpRequest() routes the request, so any node's URI will do
+		Aws::Http::URI uri = snapshot->nodes.front()->uri;
+		Aws::String unprocessed;
+		for (uint32_t round = 0; ; ++round) {
+			const Aws::String& body = round == 0 ? writer.Body() : unprocessed;
+			AlternatorRawRequest request(writer.Operation(), body.data(), body.size());
+			request.SetResponseStreamFactory(&AlternatorResponseStream::Create);
+			if (round > 0) {
+				AlternatorAttempt::Current().AvoidLastNode(request);
+			}
+			Aws::Client::StreamOutcome outcome = MakeRequestWithUnparsedResponse(uri, request);
+			if (!outcome.IsSuccess()) {
+				return AlternatorWriteResult{false, outcome.GetError().GetMessage()};
+			}
+			const AlternatorResponseStream* response = dynamic_cast<const AlternatorResponseStream*>(&outcome.GetResult().GetPayload().GetUnderlyingStream());
+			if (!response) {
+				return AlternatorWriteResult{false, "The response was not received into AlternatorResponseStream"};
+			}
+			// The unprocessed items have the format of the request's items
+			AlternatorJsonReader reader(response->Buffer().Data(), response->Buffer().Data() + response->Buffer().Size());
+			const char* begin = nullptr;
+			const char* end = nullptr;
+			Aws::String name;
+			reader.BeginObject();
+			while (reader.NextMember(name)) {
+				if (name == "UnprocessedItems") {
+					reader.ReadRaw(begin, end);
+				} else {
+					reader.SkipValue();
+				}
+			}
+			if (reader.Failed()) {
+				return AlternatorWriteResult{false, "Malformed response to " + Aws::String(writer.Operation())};
+			}
+			AlternatorJsonReader items(begin, end);
+			if (!begin || !items.BeginObject() || !items.NextMember(name)) {
+				return AlternatorWriteResult{true, Aws::String()};
+			}
+			if (round == max_unprocessed_retries) {
+				return AlternatorWriteResult{false, "Alternator left items unprocessed"};
+			}
+			unprocessed = "{\"RequestItems\":";
+			unprocessed.append(begin, end);
+			unprocessed += '}';
+			std::this_thread::sleep_for(backoff);
+			backoff *= 2;
+		}
+	}
+
+#ifdef ALTERNATOR_COROUTINES
+	// Awaits the outcome of a request, e.g.
+	//   GetItemOutcome outcome = co_await client.GetItemCo(request);
+	// The request is sent on the executor from the client configuration,
+	// and the awaiting coroutine is resumed on the executor thread which
+	// received the response. The SDK's HTTP clients are blocking, so this
+	// frees the awaiting thread but not a thread per request: each request
+	// in flight holds an executor thread until its response arrives. The
+	// executor must therefore be a PooledThreadExecutor, whose pool bounds
+	// the requests in flight, rather than the default one, which would
+	// start a thread per request - the ...Co() methods throw
+	// std::invalid_argument otherwise. A coroutine resumed this way must
+	// not destroy the client.
+	template<typename Outcome>
+	class Awaitable {
+	public:
+		Awaitable(const AlternatorClient& client, std::function<Outcome()> send)
+			: _client(client)
+			, _send(std::move(send)) {}
+
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle) {
+			// Once submitted, the task may resume the coroutine, and with
+			// it destroy this awaitable, before RunInBackground() returns
+			bool submitted = _client.RunInBackground([this, handle] {
+				_outcome = _send();
+				handle.resume();
+			});
+			if (!submitted) {
+				_outcome = _send();
+			}
+			return submitted;
+		}
+
+		Outcome await_resume() {
+			return std::move(_outcome);
+		}
+
+	private:
+		const AlternatorClient& _client;
+		std::function<Outcome()> _send;
+		Outcome _outcome;
+	};
+
+	Awaitable<Aws::DynamoDB::Model::GetItemOutcome> GetItemCo(const Aws::DynamoDB::Model::GetItemRequest& request) const {
+		return Await(&Aws::DynamoDB::DynamoDBClient::GetItem, request);
+	}
+
+	Awaitable<Aws::DynamoDB::Model::PutItemOutcome> PutItemCo(const Aws::DynamoDB::Model::PutItemRequest& request) const {
+		return Await(&Aws::DynamoDB::DynamoDBClient::PutItem, request);
+	}
+
+	Awaitable<Aws::DynamoDB::Model::UpdateItemOutcome> UpdateItemCo(const Aws::DynamoDB::Model::UpdateItemRequest& request) const {
+		return Await(&Aws::DynamoDB::DynamoDBClient::UpdateItem, request);
+	}
+
+	Awaitable<Aws::DynamoDB::Model::DeleteItemOutcome> DeleteItemCo(const Aws::DynamoDB::Model::DeleteItemRequest& request) const {
+		return Await(&Aws::DynamoDB::DynamoDBClient::DeleteItem, request);
+	}
+
+	Awaitable<Aws::DynamoDB::Model::BatchGetItemOutcome> BatchGetItemCo(const Aws::DynamoDB::Model::BatchGetItemRequest& request) const {
+		return Await(&Aws::DynamoDB::DynamoDBClient::BatchGetItem, request);
+	}
+
+	Awaitable<Aws::DynamoDB::Model::BatchWriteItemOutcome> BatchWriteItemCo(const Aws::DynamoDB::Model::BatchWriteItemRequest& request) const {
+		return Await(&Aws::DynamoDB::DynamoDBClient::BatchWriteItem, request);
+	}
+
+	Awaitable<Aws::DynamoDB::Model::QueryOutcome> QueryCo(const Aws::DynamoDB::Model::QueryRequest& request) const {
+		return Await(&Aws::DynamoDB::DynamoDBClient::Query, request);
+	}
+
+	Awaitable<Aws::DynamoDB::Model::ScanOutcome> ScanCo(const Aws::DynamoDB::Model::ScanRequest& request) const {
+		return Await(&Aws::DynamoDB::DynamoDBClient::Scan, request);
+	}
+#endif
+
+	std::shared_ptr<const AlternatorNodeSnapshot> CurrentNodes() const {
+		return _nodes.Load();
+	}
+
+	template<typename Duration>
+	void StartNodeUpdater(Duration duration, size_t parallel_fetches = 2) {
+		_node_updater = std::unique_ptr<std::thread>(new std::thread([this, duration, parallel_fetches] {
+			std::minstd_rand rng(std::random_device{}());
+			std::chrono::milliseconds min_interval = std::chrono::duration_cast<std::chrono::milliseconds>(duration);
+			std::chrono::milliseconds interval = min_interval;
+			std::chrono::milliseconds backoff(0);
+			std::chrono::milliseconds delay = _nodes_fetched ? interval : std::chrono::milliseconds(0);
+			bool triggered = false;
+			while (!WaitForRefresh(delay, triggered)) {
+				uint64_t epoch = _topology_epoch.load();
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				bool refreshed = RefreshNodes(parallel_fetches, [this] (const std::vector<Aws::String>& nodes, const std::vector<Aws::String>& fallback_nodes) {
+					PublishNodes(nodes, fallback_nodes, true);
+				});
+				RecordRefresh(refreshed, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+				if (_adaptive_refresh) {
+					interval = NextRefreshInterval(interval, min_interval, triggered || _topology_epoch.load() != epoch, refreshed);
+				}
+				delay = NextRefreshDelay(refreshed, interval, backoff, rng);
+			}
+		}));
+	}
+
+	// With adaptive refreshes, the update thread started by
+	// StartNodeUpdater() refreshes less and less often while the cluster
+	// is stable, and goes back to the interval it was started with as soon
+	// as nodes join or leave, or requests fail because of their node -
+	// which also triggers a refresh right away. Must be called before
+	// StartNodeUpdater().
+	void EnableAdaptiveRefresh(const AlternatorRefreshOptions& options = AlternatorRefreshOptions()) {
+		_refresh_options = options;
+		_adaptive_refresh = true;
+	}
+
+	// Makes the update thread started by StartNodeUpdater() refresh the
+	// node list right away, e.g. after errors only the application can
+	// interpret. With adaptive refreshes, requests are ignored within
+	// min_trigger_interval of the last one.
+	void RequestRefresh() const {
+		if (_adaptive_refresh) {
+			int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			int64_t last = _last_refresh_request_ms.load(std::memory_order_relaxed);
+			if (now - last < _refresh_options.min_trigger_interval.count()
+					|| !_last_refresh_request_ms.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+				return;
+			}
+		}
+		std::lock_guard<std::mutex> lock(_background_tasks_mutex);
+		_refresh_requested = true;
+		_shutdown.notify_all();
+	}
+
+	// Like StartNodeUpdater(), but shares a single update thread with all
+	// other clients in the process which were constructed with the same
+	// protocol, nodes, port, datacenter and rack, and which also share
+	// their updates. The thread refreshes as often as the client which
+	// asked for the shortest interval wants, and publishes every node list
+	// to all of the clients.
+	template<typename Duration>
+	void StartSharedNodeUpdater(Duration duration, size_t parallel_fetches = 2) {
+		JoinTopology(std::chrono::duration_cast<std::chrono::milliseconds>(duration), parallel_fetches);
+	}
+
+protected:
+	// Contacts the nodes of the rack and the rest of the datacenter in turn,
+	// so that a single dead node cannot stall all refreshes.
+	Aws::Http::URI GetURIForUpdates() const {
+		std::shared_ptr<const AlternatorNodeSnapshot> snapshot = CurrentNodes();
+		assert(!snapshot->nodes.empty());
+		size_t fallback_size = snapshot->fallback ? snapshot->fallback->nodes.size() : 0;
+		size_t idx = _updater_idx.fetch_add(1, std::memory_order_relaxed) % (snapshot->nodes.size() + fallback_size);
+		Aws::Http::URI ret = idx < snapshot->nodes.size() ? snapshot->nodes[idx]->uri : snapshot->fallback->nodes[idx - snapshot->nodes.size()]->uri;
+		ret.SetPath(ret.GetPath() + "/localnodes");
+		return ret;
+	}
+
+	// Defined after AlternatorTopology
+	void JoinTopology(std::chrono::milliseconds interval, size_t parallel_fetches);
+	void LeaveTopology();
+
+	void RecordRefresh(bool refreshed, std::chrono::microseconds latency) {
+		_refresh_counters.Record(!refreshed, false, latency);
+		if (_metrics_observer) {
+			_metrics_observer->RefreshFinished(refreshed, latency);
+		}
+	}
+
+	std::chrono::milliseconds NextRefreshInterval(std::chrono::milliseconds interval, std::chrono::milliseconds min_interval,
+			bool changed, bool refreshed) const {
+		if (changed) {
+			return min_interval;
+		}
+		if (!refreshed) {
+			return interval;
+		}
+		std::chrono::milliseconds grown(static_cast<int64_t>(interval.count() * _refresh_options.growth_factor));
+		return std::max(min_interval, std::min(grown, _refresh_options.max_interval));
+	}
+
+	// Like WaitForShutdown(), but also cut short by RequestRefresh(), in
+	// which case triggered is set
+	bool WaitForRefresh(std::chrono::milliseconds delay, bool& triggered) const {
+		std::unique_lock<std::mutex> lock(_background_tasks_mutex);
+		_shutdown.wait_for(lock, delay, [this] { return _shutting_down || _refresh_requested; });
+		triggered = _refresh_requested;
+		_refresh_requested = false;
+		return _shutting_down;
+	}
+
+	static std::chrono::milliseconds NextRefreshDelay(bool refreshed, std::chrono::milliseconds interval,
+			std::chrono::milliseconds& backoff, std::minstd_rand& rng) {
+		if (refreshed) {
+			backoff = std::chrono::milliseconds(0);
+			return interval;
+		}
+		// Retry sooner than a regular refresh, with full jitter so that many
+		// clients do not retry in lockstep
+		backoff = std::min(std::max(backoff * 2, std::chrono::milliseconds(100)), interval);
+		return std::chrono::milliseconds(rng() % (backoff.count() + 1));
+	}
+
+	// Fetches the node list from several nodes at once on the executor and
+	// publishes the first answer, so that a node which is down or slow
+	// costs a refresh no more than the control HTTP client's timeout. If
+	// none of the current nodes answers, e.g. because they all came from a
+	// stale topology cache, the seed nodes given to the constructor are
+	// asked instead. Returns false if no node answered.
+	bool RefreshNodes(size_t parallel_fetches,
+			const std::function<void(const std::vector<Aws::String>&, const std::vector<Aws::String>&)>& publish) {
+		std::vector<Aws::Http::URI> uris;
+		for (size_t i = std::max<size_t>(parallel_fetches, 1); i > 0; --i) {
+			uris.push_back(GetURIForUpdates());
+		}
+		if (FetchFromAny(uris, publish)) {
+			return true;
+		}
+		std::vector<Aws::Http::URI> seed_uris;
+		for (const Aws::String& seed : _seeds) {
+			Aws::Http::URI uri;
+			uri.SetScheme(_scheme);
+			uri.SetAuthority(seed);
+			uri.SetPort(_port_number);
+			uri.SetPath(uri.GetPath() + "/localnodes");
+			bool tried = false;
+			for (const Aws::Http::URI& other : uris) {
+				tried = tried || other.GetURIString() == uri.GetURIString();
+			}
+			if (!tried) {
+				seed_uris.push_back(uri);
+			}
+		}
+		return !seed_uris.empty() && FetchFromAny(seed_uris, publish);
+	}
+
+	// Fetches the node list from all of uris at once and publishes the first answer
+	bool FetchFromAny(const std::vector<Aws::Http::URI>& uris,
+			const std::function<void(const std::vector<Aws::String>&, const std::vector<Aws::String>&)>& publish) {
+		struct Refresh {
+			std::mutex mutex;
+			std::condition_variable done;
+			size_t pending;
+			bool published;
+			bool closed;
+		};
+		std::shared_ptr<Refresh> refresh = std::make_shared<Refresh>();
+		refresh->pending = uris.size();
+		refresh->published = false;
+		refresh->closed = false;
+		for (const Aws::Http::URI& uri : uris) {
+			bool submitted = RunInBackground([this, refresh, uri, publish] {
+				std::vector<Aws::String> nodes;
+				std::vector<Aws::String> fallback_nodes;
+				bool fetched = false;
+				try {
+					fetched = FetchLocalNodes(uri, nodes, fallback_nodes);
+				} catch (...) {
+					// the other fetches may still succeed
+				}
+				std::lock_guard<std::mutex> lock(refresh->mutex);
+				// Answers arriving after the refresh is over are dropped, so
+				// that only one thread publishes at a time
+				if (fetched && !refresh->published && !refresh->closed) {
+					try {
+						publish(nodes, fallback_nodes);
+						refresh->published = true;
+					} catch (...) {
+						// the node list stays as it was
+					}
+				}
+				--refresh->pending;
+				refresh->done.notify_all();
+			});
+			if (!submitted) {
+				std::lock_guard<std::mutex> lock(refresh->mutex);
+				--refresh->pending;
+			}
+		}
+		std::unique_lock<std::mutex> lock(refresh->mutex);
+		refresh->done.wait(lock, [&refresh] { return refresh->published || refresh->pending == 0; });
+		refresh->closed = true;
+		return refresh->published;
+	}
+
+	std::vector<Aws::String> FetchNodeList(const Aws::Http::URI& uri) const {
+		std::shared_ptr<Aws::Http::HttpRequest> request(new Aws::Http::Standard::StandardHttpRequest(uri, Aws::Http::HttpMethod::HTTP_GET));
+		request->SetResponseStreamFactory(&AlternatorResponseStream::Create);
+		std::shared_ptr<Aws::Http::HttpResponse> response = _control_http_client->MakeRequest(request);
+		const AlternatorResponseBuffer& body = static_cast<const AlternatorResponseStream&>(response->GetResponseBody()).Buffer();
+		AlternatorJsonReader reader(body.Data(), body.Data() + body.Size());
+		std::vector<Aws::String> nodes;
+		Aws::Map<Aws::String, double> loads;
+		Aws::String node;
+		Aws::String name;
+		if (reader.BeginArray()) {
+			// Either the node's address, or an object with the address as
+			// "host" and, optionally, the node's "load"
+			while (reader.NextElement()) {
+				if (reader.Peek() == '{') {
+					double load = -1;
+					node.clear();
+					reader.BeginObject();
+					while (reader.NextMember(name)) {
+						if (name == "host") {
+							reader.ReadString(node);
+						} else if (name == "load") {
+							reader.ReadNumber(load);
+						} else {
+							reader.SkipValue();
+						}
+					}
+					if (load >= 0) {
+						loads[node] = load;
+					}
+				} else {
+					reader.ReadString(node);
+				}
+				if (reader.Failed()) {
+					break;
+				}
+				if (node.empty()) {
+					throw std::runtime_error("Failed to fetch the list of live nodes");
+				}
+				nodes.push_back(node);
+			}
+		}
+		if (reader.Failed()) {
+			throw std::runtime_error("Failed to fetch the list of live nodes");
+		}
+		RecordReportedLoads(loads);
+		return nodes;
+	}
+
+	// Nodes which are not known yet get their load with the next refresh,
+	// or with their first response
+	void RecordReportedLoads(const Aws::Map<Aws::String, double>& loads) const {
+		if (loads.empty()) {
+			return;
+		}
+		std::shared_ptr<const AlternatorNodeSnapshot> snapshot = CurrentNodes();
+		for (const AlternatorNodeSnapshot* nodes = snapshot.get(); nodes; nodes = nodes->fallback.get()) {
+			for (const std::shared_ptr<AlternatorNode>& node : nodes->nodes) {
+				auto it = loads.find(node->host);
+				if (it != loads.end()) {
+					node->reported_load.store(it->second, std::memory_order_relaxed);
+				}
+			}
+		}
+	}
+
+	void RecordReportedLoad(AlternatorNode& node, const Aws::Client::HttpResponseOutcome& outcome) const {
+		Aws::String value;
+		if (outcome.IsSuccess()) {
+			if (!outcome.GetResult() || !outcome.GetResult()->HasHeader(_load_header.c_str())) {
+				return;
+			}
+			value = outcome.GetResult()->GetHeader(_load_header);
+		} else {
+			const Aws::Http::HeaderValueCollection& headers = outcome.GetError().GetResponseHeaders();
+			auto it = headers.find(_load_header);
+			if (it == headers.end()) {
+				return;
+			}
+			value = it->second;
+		}
+		char* parsed = nullptr;
+		double load = std::strtod(value.c_str(), &parsed);
+		if (!value.empty() && *parsed == '\0' && load >= 0) {
+			node.reported_load.store(load, std::memory_order_relaxed);
+		}
+	}
+
+	// Asks the selection policy for a node among the preferred ones, skips
+	// over unhealthy, saturated and excluded nodes, and falls back to the rest
+	// of the datacenter only if no preferred node qualifies. If none does at
+	// all, the policy's original choice is used, unless it is excluded and
+	// there is another node to try.
+	// The returned reference points into _nodes.Local(), see there: it is
+	// only valid until the calling thread next reads the node list of any
+	// AlternatorClient, e.g. to route a request or in IsSaturated().
+	const std::shared_ptr<AlternatorNode>& PickNode(const AlternatorNode* exclude = nullptr) const {
+		const AlternatorNodeSnapshot& snapshot = _nodes.Local();
+		assert(!snapshot.nodes.empty());
+		size_t idx = _selection_policy->Select(snapshot);
+		const std::shared_ptr<AlternatorNode>* node = FindHealthyNode(snapshot, idx, exclude);
+		if (!node && snapshot.fallback) {
+			node = FindHealthyNode(*snapshot.fallback, _selection_policy->Select(*snapshot.fallback), exclude);
+		}
+		if (node) {
+			return *node;
+		}
+		if (snapshot.nodes[idx].get() == exclude) {
+			if (snapshot.nodes.size() > 1) {
+				return snapshot.nodes[(idx + 1) % snapshot.nodes.size()];
+			} else if (snapshot.fallback && !snapshot.fallback->nodes.empty()) {
+				return snapshot.fallback->nodes.front();
+			}
+		}
+		return snapshot.nodes[idx];
+	}
+
+	const std::shared_ptr<AlternatorNode>* FindHealthyNode(const AlternatorNodeSnapshot& snapshot, size_t start,
+			const AlternatorNode* exclude) const {
+		size_t n = snapshot.nodes.size();
+		for (size_t i = 0; i < n; ++i) {
+			const std::shared_ptr<AlternatorNode>& node = snapshot.nodes[(start + i) % n];
+			if (IsAvailable(*node, exclude)) {
+				return &node;
+			}
+		}
+		return nullptr;
+	}
+
+	bool IsAvailable(const AlternatorNode& node, const AlternatorNode* exclude) const {
+		uint32_t limit = _connection_options.InFlightLimit();
+		uint32_t in_flight = node.in_flight.load(std::memory_order_relaxed);
+		return node.IsHealthy() && &node != exclude
+			&& (limit == 0 || in_flight < limit)
+			&& (!_concurrency_limits || in_flight < ConcurrencyLimit(node));
+	}
+
+	// Returns a healthy replica of the partition addressed by a
+	// single-partition request, other than the excluded node, or nullptr if
+	// the request should be routed by the selection policy instead. Load is
+	// spread over the replicas in the preferred rack or datacenter, the
+	// others are used only if none of those is healthy.
+	// Sets routing to how the replica was chosen, if one is returned. The
+	// returned pointer points into _table_rings.Local() or, for key
+	// affinity, into _nodes.Local() - see AlternatorPublished::Local() for
+	// how long it stays valid.
+	const std::shared_ptr<AlternatorNode>* PickReplica(const Aws::AmazonWebServiceRequest& request, std::chrono::steady_clock::time_point now,
+			const AlternatorNode* exclude, const char*& routing) const {
+		const Aws::String* table;
+		const Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue>* key;
+		if (!GetItemKey(request, table, key)) {
+			return nullptr;
+		}
+		const TableRings& rings = _table_rings.Local();
+		auto it = rings.find(*table);
+		if (it == rings.end()) {
+			LoadTableRing(*table);
+			return nullptr;
+		}
+		const AlternatorTableRing& ring = *it->second;
+		if ((ring.topology_epoch != _topology_epoch.load(std::memory_order_relaxed) || now - ring.loaded > AlternatorTableRing::TimeToLive())
+				&& !ring.reloading.load(std::memory_order_relaxed)) {
+			LoadTableRing(*table);
+		}
+		if (ring.hash_key.empty()) {
+			return nullptr;
+		}
+		auto attribute = key->find(ring.hash_key);
+		if (attribute == key->end()) {
+			return nullptr;
+		}
+		int64_t token;
+		if (ring.hash_key_type == Aws::DynamoDB::Model::ScalarAttributeType::B) {
+			const Aws::Utils::ByteBuffer& value = attribute->second.GetB();
+			token = AlternatorTableRing::Token(value.GetUnderlyingData(), value.GetLength());
+		} else {
+			const Aws::String& value = ring.hash_key_type == Aws::DynamoDB::Model::ScalarAttributeType::S
+				? attribute->second.GetS() : attribute->second.GetN();
+			token = AlternatorTableRing::Token(reinterpret_cast<const unsigned char*>(value.data()), value.size());
+		}
+		size_t preferred = 0;
+		const std::vector<std::shared_ptr<AlternatorNode>>* replicas = ring.Replicas(token, preferred);
+		if (!replicas) {
+			const std::shared_ptr<AlternatorNode>* node = _key_affinity ? PickByRendezvous(static_cast<uint64_t>(token), exclude) : nullptr;
+			if (node) {
+				routing = "key-affinity";
+			}
+			return node;
+		}
+		static thread_local size_t rotation = 0;
+		size_t start = preferred ? rotation++ % preferred : 0;
+		for (size_t i = 0; i < preferred; ++i) {
+			const std::shared_ptr<AlternatorNode>& node = (*replicas)[(start + i) % preferred];
+			if (IsAvailable(*node, exclude)) {
+				routing = "token-aware";
+				return &node;
+			}
+		}
+		for (size_t i = preferred; i < replicas->size(); ++i) {
+			if (IsAvailable(*(*replicas)[i], exclude)) {
+				routing = "token-aware";
+				return &(*replicas)[i];
+			}
+		}
+		return nullptr;
+	}
+
+	// Rendezvous hashing: the available preferred node scoring highest for
+	// the key. A node joining or leaving the list only moves the keys for
+	// which it scores highest, i.e. about 1/N of them. The returned pointer
+	// points into _nodes.Local(), like PickNode()'s.
+	const std::shared_ptr<AlternatorNode>* PickByRendezvous(uint64_t key_hash, const AlternatorNode* exclude) const {
+		const AlternatorNodeSnapshot& snapshot = _nodes.Local();
+		const std::shared_ptr<AlternatorNode>* best = nullptr;
+		uint64_t best_score = 0;
+		for (const std::shared_ptr<AlternatorNode>& node : snapshot.nodes) {
+			uint64_t score = AlternatorTableRing::FinalMix(key_hash ^ node->host_hash);
+			if ((!best || score > best_score) && IsAvailable(*node, exclude)) {
+				best = &node;
+				best_score = score;
+			}
+		}
+		return best;
+	}
+
+	static bool GetItemKey(const Aws::AmazonWebServiceRequest& request, const Aws::String*& table,
+			const Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue>*& key) {
+		const char* name = request.GetServiceRequestName();
+		if (std::strcmp(name, "GetItem") == 0) {
+			const Aws::DynamoDB::Model::GetItemRequest& get = static_cast<const Aws::DynamoDB::Model::GetItemRequest&>(request);
+			table = &get.GetTableName();
+			key = &get.GetKey();
+		} else if (std::strcmp(name, "PutItem") == 0) {
+			const Aws::DynamoDB::Model::PutItemRequest& put = static_cast<const Aws::DynamoDB::Model::PutItemRequest&>(request);
+			table = &put.GetTableName();
+			key = &put.GetItem();
+		} else if (std::strcmp(name, "UpdateItem") == 0) {
+			const Aws::DynamoDB::Model::UpdateItemRequest& update = static_cast<const Aws::DynamoDB::Model::UpdateItemRequest&>(request);
+			table = &update.GetTableName();
+			key = &update.GetKey();
+		} else if (std::strcmp(name, "DeleteItem") == 0) {
+			const Aws::DynamoDB::Model::DeleteItemRequest& del = static_cast<const Aws::DynamoDB::Model::DeleteItemRequest&>(request);
+			table = &del.GetTableName();
+			key = &del.GetKey();
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	// Schedules a (re)load of the table's ring, unless one is already in
+	// progress. A table seen for the first time gets an empty placeholder,
+	// so that requests to it keep going through the selection policy
+	// without scheduling more loads.
+	void LoadTableRing(const Aws::String& table) const {
+		{
+			std::lock_guard<std::mutex> guard(_table_rings_mutex);
+			std::shared_ptr<const TableRings> rings = _table_rings.Load();
+			auto it = rings->find(table);
+			if (it == rings->end()) {
+				std::shared_ptr<AlternatorTableRing> placeholder = std::make_shared<AlternatorTableRing>();
+				placeholder->reloading.store(true);
+				std::shared_ptr<TableRings> updated = std::make_shared<TableRings>(*rings);
+				(*updated)[table] = placeholder;
+				_table_rings.Publish(updated);
+			} else if (it->second->reloading.exchange(true)) {
+				return;
+			}
+		}
+		RunInBackground([this, table] {
+			std::shared_ptr<const AlternatorTableRing> ring;
+			try {
+				ring = FetchTableRing(table);
+			} catch (...) {
+				// Try again once the empty ring expires
+				std::shared_ptr<AlternatorTableRing> empty = std::make_shared<AlternatorTableRing>();
+				empty->topology_epoch = _topology_epoch.load();
+				ring = empty;
+			}
+			std::lock_guard<std::mutex> guard(_table_rings_mutex);
+			std::shared_ptr<TableRings> updated = std::make_shared<TableRings>(*_table_rings.Load());
+			(*updated)[table] = ring;
+			_table_rings.Publish(updated);
+		});
+	}
+
+	std::shared_ptr<const AlternatorTableRing> FetchTableRing(const Aws::String& table) const {
+		std::shared_ptr<AlternatorTableRing> ring = std::make_shared<AlternatorTableRing>();
+		ring->topology_epoch = _topology_epoch.load();
+		Aws::DynamoDB::Model::DescribeTableRequest describe;
+		describe.SetTableName(table);
+		Aws::DynamoDB::Model::DescribeTableOutcome outcome = DescribeTable(describe);
+		if (!outcome.IsSuccess()) {
+			return ring;
+		}
+		Aws::String hash_key;
+		for (const Aws::DynamoDB::Model::KeySchemaElement& element : outcome.GetResult().GetTable().GetKeySchema()) {
+			if (element.GetKeyType() == Aws::DynamoDB::Model::KeyType::HASH) {
+				hash_key = element.GetAttributeName();
+			}
+		}
+		Aws::DynamoDB::Model::ScalarAttributeType hash_key_type = Aws::DynamoDB::Model::ScalarAttributeType::N;
+		for (const Aws::DynamoDB::Model::AttributeDefinition& definition : outcome.GetResult().GetTable().GetAttributeDefinitions()) {
+			if (definition.GetAttributeName() == hash_key) {
+				hash_key_type = definition.GetAttributeType();
+			}
+		}
+		if (hash_key.empty()) {
+			return ring;
+		}
+		ring->hash_key = hash_key;
+		ring->hash_key_type = hash_key_type;
+		// Numbers are stored as decimals, whose serialization is not worth
+		// reproducing here, so their tables only get key affinity
+		if (!_rest_api_port || hash_key_type == Aws::DynamoDB::Model::ScalarAttributeType::N) {
+			return ring;
+		}
+
+		// Each Alternator table lives in its own keyspace
+		std::shared_ptr<const AlternatorNodeSnapshot> snapshot = CurrentNodes();
+		Aws::Http::URI uri = snapshot->nodes[_updater_idx.fetch_add(1, std::memory_order_relaxed) % snapshot->nodes.size()]->uri;
+		uri.SetScheme(Aws::Http::Scheme::HTTP);
+		uri.SetPort(_rest_api_port);
+		uri.SetPath("/storage_service/describe_ring/alternator_" + table);
+		uri.AddQueryStringParameter("table", table);
+		std::shared_ptr<Aws::Http::HttpRequest> request(new Aws::Http::Standard::StandardHttpRequest(uri, Aws::Http::HttpMethod::HTTP_GET));
+		request->SetResponseStreamFactory([] { return new std::stringstream; });
+		std::shared_ptr<Aws::Http::HttpResponse> response = MakeHttpRequest(request);
+		if (!response || response->GetResponseCode() != Aws::Http::HttpResponseCode::OK) {
+			throw std::runtime_error("Failed to fetch the token ring of " + std::string(table.c_str()));
+		}
+		Aws::Utils::Json::JsonValue json_raw = response->GetResponseBody();
+		Aws::Utils::Json::JsonView json = json_raw.View();
+		if (!json.IsListType()) {
+			throw std::runtime_error("Failed to fetch the token ring of " + std::string(table.c_str()));
+		}
+
+		// Only nodes the client routes to are used as replicas, preferred ones first
+		Aws::Map<Aws::String, std::pair<std::shared_ptr<AlternatorNode>, bool>> known;
+		for (const std::shared_ptr<AlternatorNode>& node : snapshot->nodes) {
+			known[node->host] = std::make_pair(node, true);
+		}
+		if (snapshot->fallback) {
+			for (const std::shared_ptr<AlternatorNode>& node : snapshot->fallback->nodes) {
+				known[node->host] = std::make_pair(node, false);
+			}
+		}
+		std::vector<std::pair<int64_t, size_t>> order;
+		std::vector<std::vector<std::shared_ptr<AlternatorNode>>> replicas;
+		std::vector<size_t> preferred_replicas;
+		Aws::Utils::Array<Aws::Utils::Json::JsonView> ranges = json.AsArray();
+		for (size_t i = 0; i < ranges.GetLength(); ++i) {
+			Aws::Utils::Json::JsonView range = ranges.GetUnderlyingData()[i];
+			Aws::Utils::Array<Aws::Utils::Json::JsonView> endpoints = range.GetArray(range.ValueExists("rpc_endpoints") ? "rpc_endpoints" : "endpoints");
+			std::vector<std::shared_ptr<AlternatorNode>> preferred;
+			std::vector<std::shared_ptr<AlternatorNode>> others;
+			for (size_t j = 0; j < endpoints.GetLength(); ++j) {
+				auto it = known.find(endpoints.GetUnderlyingData()[j].AsString());
+				if (it != known.end()) {
+					(it->second.second ? preferred : others).push_back(it->second.first);
+				}
+			}
+			order.push_back(std::make_pair(std::stoll(range.GetString("end_token").c_str()), replicas.size()));
+			preferred_replicas.push_back(preferred.size());
+			preferred.insert(preferred.end(), others.begin(), others.end());
+			replicas.push_back(std::move(preferred));
+		}
+		std::sort(order.begin(), order.end());
+		for (const std::pair<int64_t, size_t>& range : order) {
+			ring->end_tokens.push_back(range.first);
+			ring->replicas.push_back(std::move(replicas[range.second]));
+			ring->preferred_replicas.push_back(preferred_replicas[range.second]);
+		}
+		return ring;
+	}
+
+#ifdef ALTERNATOR_ZLIB
+	void Compress(Aws::Http::HttpRequest& httpRequest, const AlternatorNode& node, AlternatorAttempt& attempt) const {
+		// A response stream the caller asked for is left alone, and so gets
+		// the response uncompressed
+		if (_compression_options.compressed_responses && HasDefaultResponseStream(httpRequest)) {
+			httpRequest.SetHeaderValue(Aws::Http::ACCEPT_ENCODING_HEADER, "gzip");
+			httpRequest.SetResponseStreamFactory(&AlternatorResponseStream::Create);
+			Aws::Http::DataReceivedEventHandler handler = httpRequest.GetDataReceivedEventHandler();
+			httpRequest.SetDataReceivedEventHandler([handler](const Aws::Http::HttpRequest* request, Aws::Http::HttpResponse* response, long long size) {
+				if (response->HasHeader(Aws::Http::CONTENT_ENCODING_HEADER) && response->GetHeader(Aws::Http::CONTENT_ENCODING_HEADER) == "gzip") {
+					static_cast<AlternatorResponseStream&>(response->GetResponseBody()).Decompress();
+				}
+				if (handler) {
+					handler(request, response, size);
+				}
+			});
+		}
+		const std::shared_ptr<Aws::IOStream>& body = httpRequest.GetContentBody();
+		if (!body || attempt.uncompressed || node.rejects_compression.load(std::memory_order_relaxed)) {
+			return;
+		}
+		body->seekg(0, std::ios_base::end);
+		std::streamoff size = body->tellg();
+		body->seekg(0, std::ios_base::beg);
+		if (size <= 0 || static_cast<size_t>(size) < _compression_options.min_request_size) {
+			body->clear();
+			return;
+		}
+		Aws::String plain(static_cast<size_t>(size), '\0');
+		body->read(&plain[0], size);
+		body->clear();
+		body->seekg(0, std::ios_base::beg);
+		Aws::String compressed;
+		if (!Gzip(plain, _compression_options.level, compressed) || compressed.size() >= plain.size()) {
+			return;
+		}
+		httpRequest.SetContentLength(std::to_string(compressed.size()).c_str());
+		httpRequest.AddContentBody(Aws::MakeShared<Aws::StringStream>("AlternatorClient", compressed));
+		httpRequest.SetHeaderValue(Aws::Http::CONTENT_ENCODING_HEADER, "gzip");
+		attempt.compressed = true;
+	}
+
+	// Whether the response goes to the SDK's stream or to this client's,
+	// rather than to one the caller set on the request
+	static bool HasDefaultResponseStream(const Aws::Http::HttpRequest& httpRequest) {
+		typedef Aws::IOStream* (*Factory)();
+		const Factory* factory = httpRequest.GetResponseStreamFactory().target<Factory>();
+		return !httpRequest.GetResponseStreamFactory() || (factory && (*factory == &Aws::Utils::Stream::DefaultResponseStreamFactoryMethod
+				|| *factory == &AlternatorResponseStream::Create));
+	}
+
+	static bool Gzip(const Aws::String& plain, int level, Aws::String& compressed) {
+		z_stream stream = z_stream();
+		// 16 added to the window size selects the gzip format
+		if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			return false;
+		}
+		compressed.resize(deflateBound(&stream, static_cast<uLong>(plain.size())));
+		stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(plain.data()));
+		stream.avail_in = static_cast<uInt>(plain.size());
+		stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+		stream.avail_out = static_cast<uInt>(compressed.size());
+		int ret = deflate(&stream, Z_FINISH);
+		compressed.resize(stream.total_out);
+		deflateEnd(&stream);
+		return ret == Z_STREAM_END;
+	}
+#endif
+
+	// Decides whether the attempt about to be sent is traced, asking the
+	// tracer only for the first attempt of a request. routed is when
+	// picking the node started.
+	void StartTrace(AlternatorAttempt& attempt, const Aws::AmazonWebServiceRequest& request, std::chrono::steady_clock::time_point routed,
+			const char* routing) const {
+		if (attempt.trace_request != &request) {
+			attempt.trace_request = &request;
+			attempt.trace_sampled = _tracer->ShouldTrace(request);
+			attempt.attempt_number = 0;
+			attempt.backoff = std::chrono::microseconds(0);
+		} else {
+			++attempt.attempt_number;
+			attempt.backoff = std::chrono::duration_cast<std::chrono::microseconds>(routed - attempt.ended);
+		}
+		attempt.traced = attempt.trace_sampled;
+		attempt.routing = routing;
+		attempt.routing_time = std::chrono::duration_cast<std::chrono::microseconds>(attempt.start - routed);
+	}
+
+	// Called by AlternatorAttempt::End() for a traced attempt
+	void TraceAttempt(const AlternatorAttempt& attempt, const AlternatorNode& node, const Aws::Client::HttpResponseOutcome& outcome,
+			bool node_failure, std::chrono::microseconds latency) const {
+		AlternatorAttemptTrace trace;
+		trace.operation = attempt.trace_request->GetServiceRequestName();
+		trace.node = &node;
+		trace.policy = _selection_policy->Name();
+		trace.routing = attempt.routing;
+		trace.attempt = attempt.attempt_number;
+		trace.hedge = attempt.is_hedge;
+		trace.error = !outcome.IsSuccess();
+		trace.node_failure = node_failure;
+		if (outcome.IsSuccess()) {
+			trace.response_code = outcome.GetResult()->GetResponseCode();
+			trace.error_type = "";
+		} else {
+			trace.response_code = outcome.GetError().GetResponseCode();
+			trace.error_type = outcome.GetError().GetExceptionName().c_str();
+		}
+		trace.start = std::chrono::system_clock::now() - std::chrono::duration_cast<std::chrono::system_clock::duration>(latency);
+		trace.routing_time = attempt.routing_time;
+		trace.backoff = attempt.backoff;
+		trace.latency = latency;
+		_tracer->AttemptFinished(trace);
+	}
+
+	// Accounts for a finished attempt. Called by AlternatorAttempt::End().
+	void RecordAttempt(const std::shared_ptr<AlternatorNode>& node, bool error, bool node_failure, bool overload, std::chrono::microseconds latency) const {
+		if (_concurrency_limits) {
+			AdaptConcurrencyLimit(*node, overload, latency);
+		}
+		node->RecordLatency(latency);
+		node->counters.Record(error, node_failure, latency);
+		if (_metrics_observer) {
+			_metrics_observer->AttemptFinished(*node, error, node_failure, latency);
+		}
+		if (!node_failure) {
+			node->RecordSuccess();
+		} else {
+			if (node->RecordFailure(_health_check_options.quarantine_threshold)) {
+				ProbeUntilHealthy(node);
+			}
+			// The node may have left the cluster
+			if (_adaptive_refresh) {
+				RequestRefresh();
+			}
+		}
+	}
+
+	// AIMD, as in TCP congestion control. Updates race with each other,
+	// which at worst drops one of them.
+	void AdaptConcurrencyLimit(AlternatorNode& node, bool overload, std::chrono::microseconds latency) const {
+		const AlternatorConcurrencyLimitOptions& options = _concurrency_limit_options;
+		int64_t average = node.latency_ewma_us.load(std::memory_order_relaxed);
+		if (options.latency_tolerance > 0 && average > 0 && latency.count() > options.latency_tolerance * average) {
+			overload = true;
+		}
+		double limit = ConcurrencyLimit(node);
+		double updated;
+		if (overload) {
+			updated = std::max<double>(limit * options.backoff_ratio, options.min_limit);
+		} else if (2 * (node.in_flight.load(std::memory_order_relaxed) + 1) >= limit) {
+			updated = std::min<double>(limit + 1 / limit, options.max_limit);
+		} else {
+			updated = limit;
+		}
+		node.concurrency_limit.store(updated, std::memory_order_relaxed);
+		// Pairs with the fence in WaitForCapacity(), so that either a waiter
+		// is seen here or the finished request is seen there
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (_capacity_waiters.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> lock(_capacity_mutex);
+			_capacity.notify_all();
+		}
+	}
+
+	double ConcurrencyLimit(const AlternatorNode& node) const {
+		double limit = node.concurrency_limit.load(std::memory_order_relaxed);
+		return limit > 0 ? limit : _concurrency_limit_options.initial_limit;
+	}
+
+	// Blocks while every healthy node is at its limit, but at most for
+	// max_wait, and picks a node again. Waiting keeps callers from piling
+	// up requests when the whole cluster is saturated.
+	const std::shared_ptr<AlternatorNode>& WaitForCapacity(const AlternatorNode* exclude) const {
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + _concurrency_limit_options.max_wait;
+		std::unique_lock<std::mutex> lock(_capacity_mutex);
+		_capacity_waiters.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		while (IsSaturated(exclude) && _capacity.wait_until(lock, deadline) == std::cv_status::no_timeout) {
+		}
+		_capacity_waiters.fetch_sub(1, std::memory_order_relaxed);
+		lock.unlock();
+		return PickNode(exclude);
+	}
+
+	// Whether there are healthy nodes, and all of them have as many requests
+	// in flight as they are allowed
+	bool IsSaturated(const AlternatorNode* exclude) const {
+		bool healthy = false;
+		for (const AlternatorNodeSnapshot* snapshot = &_nodes.Local(); snapshot; snapshot = snapshot->fallback.get()) {
+			for (const std::shared_ptr<AlternatorNode>& node : snapshot->nodes) {
+				if (IsAvailable(*node, exclude)) {
+					return false;
+				}
+				healthy = healthy || (node->IsHealthy() && node.get() != exclude);
+			}
+		}
+		return healthy;
+	}
+
+	// Probes a quarantined node with exponential backoff and readmits it
+	// once it answers. Probing stops if the node leaves the node list - if
+	// it comes back later, it does so as a new, healthy node.
+	void ProbeUntilHealthy(const std::shared_ptr<AlternatorNode>& node) const {
+		RunInBackground([this, node] {
+			std::chrono::milliseconds delay = _health_check_options.probe_interval;
+			while (!WaitForShutdown(delay) && IsKnownNode(*node)) {
+				if (ProbeNode(*node)) {
+					node->Readmit();
+					return;
+				}
+				delay = std::min(delay * 2, _health_check_options.max_probe_interval);
+			}
+		});
+	}
+
+	// Alternator answers GET / with 200 OK as its health check
+	bool ProbeNode(const AlternatorNode& node) const {
+		std::shared_ptr<Aws::Http::HttpRequest> request(new Aws::Http::Standard::StandardHttpRequest(node.uri, Aws::Http::HttpMethod::HTTP_GET));
+		request->SetResponseStreamFactory([] { return new std::stringstream; });
+		std::shared_ptr<Aws::Http::HttpResponse> response = _control_http_client->MakeRequest(request);
+		return response && response->GetResponseCode() == Aws::Http::HttpResponseCode::OK;
+	}
+
+	bool IsKnownNode(const AlternatorNode& node) const {
+		std::shared_ptr<const AlternatorNodeSnapshot> snapshot = CurrentNodes();
+		for (const AlternatorNodeSnapshot* nodes = snapshot.get(); nodes; nodes = nodes->fallback.get()) {
+			for (const std::shared_ptr<AlternatorNode>& known : nodes->nodes) {
+				if (known.get() == &node) {
+					return true;
+				}
+			}
 		}
+		return false;
+	}
 
-	virtual ~AlternatorClient() {
-		_keep_updating = false;
-		if (_node_updater) {
-			_node_updater->join();
+	// Returns true if the client is being destroyed, possibly cutting the wait short
+	template<typename Duration>
+	bool WaitForShutdown(Duration duration) const {
+		std::unique_lock<std::mutex> lock(_background_tasks_mutex);
+		return _shutdown.wait_for(lock, duration, [this] { return _shutting_down; });
+	}
+
+	template<typename Request>
+	AlternatorScanResult StreamItems(Request request,
+			const std::function<bool(const Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue>&)>& callback) const {
+		std::shared_ptr<const AlternatorNodeSnapshot> snapshot = CurrentNodes();
+		if (snapshot->nodes.empty()) {
+			return AlternatorScanResult{false, "No Alternator nodes are known", 0};
+		}
+		// BuildHttpRequest() routes the request, so any node's URI will do
+		Aws::Http::URI uri = snapshot->nodes.front()->uri;
+		request.SetResponseStreamFactory(&AlternatorResponseStream::Create);
+		AlternatorScanResult result{true, Aws::String(), 0};
+		Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue> item;
+		Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue> last_key;
+		Aws::String name;
+		for (;;) {
+			Aws::Client::StreamOutcome outcome = MakeRequestWithUnparsedResponse(uri, request);
+			if (!outcome.IsSuccess()) {
+				result.succeeded = false;
+				result.error = outcome.GetError().GetMessage();
+				return result;
+			}
+			const AlternatorResponseStream* body = dynamic_cast<const AlternatorResponseStream*>(&outcome.GetResult().GetPayload().GetUnderlyingStream());
+			if (!body) {
+				result.succeeded = false;
+				result.error = "The response was not received into AlternatorResponseStream";
+				return result;
+			}
+			AlternatorJsonReader reader(body->Buffer().Data(), body->Buffer().Data() + body->Buffer().Size());
+			bool keep_going = true;
+			last_key.clear();
+			reader.BeginObject();
+			while (keep_going && reader.NextMember(name)) {
+				if (name == "Items") {
+					reader.BeginArray();
+					while (keep_going && reader.NextElement()) {
+						item.clear();
+						if (!reader.ReadItem(item)) {
+							break;
+						}
+						++result.items;
+						keep_going = callback(item);
+					}
+				} else if (name == "LastEvaluatedKey") {
+					reader.ReadItem(last_key);
+				} else {
+					reader.SkipValue();
+				}
+			}
+			if (reader.Failed()) {
+				result.succeeded = false;
+				result.error = "Malformed response to " + Aws::String(request.GetServiceRequestName());
+				return result;
+			}
+			if (!keep_going || last_key.empty()) {
+				return result;
+			}
+			request.SetExclusiveStartKey(last_key);
 		}
 	}
 
-	virtual void BuildHttpRequest(const Aws::AmazonWebServiceRequest &request, const std::shared_ptr< Aws::Http::HttpRequest > &httpRequest) const override {
-		Aws::Http::URI next = NextNode();
-		httpRequest->GetUri() = std::move(next);
-		return Aws::DynamoDB::DynamoDBClient::BuildHttpRequest(request, httpRequest);
+#ifdef ALTERNATOR_COROUTINES
+	// The call through the member pointer is virtual, so hedged reads are
+	// hedged when awaited too
+	template<typename Outcome, typename Request>
+	Awaitable<Outcome> Await(Outcome (Aws::DynamoDB::DynamoDBClient::*operation)(const Request&) const, const Request& request) const {
+		if (!dynamic_cast<Aws::Utils::Threading::PooledThreadExecutor*>(_executor.get())) {
+			throw std::invalid_argument("Awaitable requests need a PooledThreadExecutor in the client configuration");
+		}
+		return Awaitable<Outcome>(*this, [this, operation, request] { return (this->*operation)(request); });
 	}
+#endif
 
-	void FetchLocalNodes() {
-		Aws::Http::URI uri;
+	struct ParallelScanState {
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::vector<std::shared_ptr<AlternatorNode>> nodes;
+		size_t concurrency;
+		int total_segments;
+		size_t max_buffered_pages;
+		// Segments whose next page can be requested, with the key to start from
+		std::deque<std::pair<int, Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue>>> ready;
+		std::deque<Aws::DynamoDB::Model::ScanResult> pages;
+		size_t fetching;
+		int finished_segments;
+		// Also set when the scan stops early, so that no new pages are requested
+		bool failed;
+		Aws::String error;
+
+		ParallelScanState() : concurrency(0), total_segments(0), max_buffered_pages(0), fetching(0), finished_segments(0), failed(false) {}
+	};
+
+	// Called with the scan's lock held
+	void RequestPages(const std::shared_ptr<ParallelScanState>& scan, const Aws::DynamoDB::Model::ScanRequest& request) const {
+		while (!scan->failed && !scan->ready.empty() && scan->fetching < scan->concurrency
+				&& scan->pages.size() + scan->fetching < scan->max_buffered_pages) {
+			Aws::DynamoDB::Model::ScanRequest page_request(request);
+			int segment = scan->ready.front().first;
+			page_request.SetSegment(segment);
+			page_request.SetTotalSegments(scan->total_segments);
+			if (!scan->ready.front().second.empty()) {
+				page_request.SetExclusiveStartKey(scan->ready.front().second);
+			}
+			scan->ready.pop_front();
+			std::shared_ptr<AlternatorNode> node = scan->nodes[segment % scan->nodes.size()];
+			bool submitted = RunInBackground([this, scan, page_request, segment, node] {
+				AlternatorAttempt& attempt = AlternatorAttempt::Current();
+				attempt.pinned_node = node;
+				Aws::DynamoDB::Model::ScanOutcome outcome = Scan(page_request);
+				attempt.pinned_node.reset();
+				std::lock_guard<std::mutex> lock(scan->mutex);
+				--scan->fetching;
+				if (!outcome.IsSuccess()) {
+					if (!scan->failed) {
+						scan->failed = true;
+						scan->error = outcome.GetError().GetMessage();
+					}
+				} else {
+					Aws::DynamoDB::Model::ScanResult page = outcome.GetResultWithOwnership();
+					if (page.GetLastEvaluatedKey().empty()) {
+						++scan->finished_segments;
+					} else {
+						scan->ready.push_back(std::make_pair(segment, page.GetLastEvaluatedKey()));
+					}
+					scan->pages.push_back(std::move(page));
+				}
+				scan->changed.notify_all();
+			});
+			if (submitted) {
+				++scan->fetching;
+			} else {
+				scan->failed = true;
+				scan->error = "The executor refused to send a Scan request";
+			}
+		}
+	}
+
+	// The first copy is sent on the calling thread. Once it has picked its
+	// node, ScheduleHedge() has the hedge timer send the hedge if the read
+	// is still unanswered after the delay, so that a read which is not
+	// hedged costs no executor task.
+	template<typename Outcome, typename Request, typename Read>
+	Outcome HedgedRead(const Request& request, Read read) const {
+		if (!_hedging) {
+			return read(request);
+		}
+		EarnHedgeBudget();
+		std::shared_ptr<AlternatorHedgedRead<Outcome>> hedge = std::make_shared<AlternatorHedgedRead<Outcome>>();
+		hedge->send = [this, &request, read](const std::shared_ptr<AlternatorHedge>& state) {
+			return SendHedge(std::static_pointer_cast<AlternatorHedgedRead<Outcome>>(state), request, read);
+		};
+		AlternatorAttempt& attempt = AlternatorAttempt::Current();
+		attempt.hedge = hedge.get();
+		Outcome outcome;
+		try {
+			outcome = read(request);
+		} catch (...) {
+			attempt.hedge = nullptr;
+			hedge->Abandon();
+			throw;
+		}
+		attempt.hedge = nullptr;
+		hedge->Answer(std::move(outcome));
+		std::unique_lock<std::mutex> lock(hedge->mutex);
+		hedge->changed.wait(lock, [&hedge] { return hedge->finished.load(); });
+		return std::move(hedge->outcome);
+	}
+
+	template<typename Outcome, typename Request, typename Read>
+	bool SendHedge(const std::shared_ptr<AlternatorHedgedRead<Outcome>>& hedge, const Request& request, Read read) const {
+		Request copy(request);
+		return RunInBackground([hedge, copy, read] {
+			AlternatorAttempt& attempt = AlternatorAttempt::Current();
+			attempt.hedge = hedge.get();
+			attempt.is_hedge = true;
+			Outcome outcome;
+			try {
+				outcome = read(copy);
+			} catch (...) {
+				// answered with the default, failed outcome below
+			}
+			attempt.hedge = nullptr;
+			attempt.is_hedge = false;
+			hedge->Answer(std::move(outcome));
+		});
+	}
+
+	// Called when the first copy of a hedged read has picked its node. Its
+	// retries keep the schedule of the first attempt.
+	void ScheduleHedge(AlternatorHedge& hedge, const std::shared_ptr<AlternatorNode>& node) const {
+		std::lock_guard<std::mutex> lock(hedge.mutex);
+		if (hedge.primary) {
+			return;
+		}
+		hedge.primary = node;
+		std::chrono::microseconds delay;
+		if (!HedgeDelay(*node, delay)) {
+			return;
+		}
+		PendingHedge pending;
+		pending.deadline = std::chrono::steady_clock::now() + delay;
+		pending.hedge = hedge.shared_from_this();
+		bool earliest;
 		{
-			std::lock_guard<std::mutex> guard(_nodes_mutex);
-			assert(!_nodes.empty());
-			uri = GetURIForUpdates();
+			std::lock_guard<std::mutex> timer_lock(_pending_hedges_mutex);
+			earliest = _pending_hedges.empty() || pending.deadline < _pending_hedges.top().deadline;
+			_pending_hedges.push(std::move(pending));
 		}
-		std::shared_ptr<Aws::Http::HttpRequest> request(new Aws::Http::Standard::StandardHttpRequest(uri, Aws::Http::HttpMethod::HTTP_GET));
-		request->SetResponseStreamFactory([] { return new std::stringstream; });
-		std::shared_ptr<Aws::Http::HttpResponse> response = MakeHttpRequest(request);
-		Aws::Utils::Json::JsonValue json_raw = response->GetResponseBody();
-		Aws::Utils::Json::JsonView json = json_raw.View();
-		if (json.IsListType()) {
-			std::vector<Aws::Http::URI> nodes;
-			Aws::Utils::Array<Aws::Utils::Json::JsonView> endpoints = json.AsArray();
-			Aws::Utils::Json::JsonView* raw_endpoints = endpoints.GetUnderlyingData();
-			for (size_t i = 0; i < endpoints.GetLength(); ++i) {
-				const Aws::Utils::Json::JsonView& element = raw_endpoints[i];
-				if (element.IsString()) {
-					nodes.push_back(Aws::Http::URI(_protocol + "://" + element.AsString() + ":" + _port));
-				}
+		if (earliest) {
+			_pending_hedges_changed.notify_one();
+		}
+	}
+
+	// The body of the _hedge_timer thread
+	void RunHedgeTimer() const {
+		std::unique_lock<std::mutex> lock(_pending_hedges_mutex);
+		while (!_hedge_timer_stopping) {
+			if (_pending_hedges.empty()) {
+				_pending_hedges_changed.wait(lock);
+				continue;
 			}
-			if (!nodes.empty()) {
-				std::lock_guard<std::mutex> guard(_nodes_mutex);
-				_nodes = std::move(nodes);
-				_node_idx = 0;
+			std::chrono::steady_clock::time_point deadline = _pending_hedges.top().deadline;
+			if (std::chrono::steady_clock::now() < deadline) {
+				_pending_hedges_changed.wait_until(lock, deadline);
+				continue;
 			}
-		} else {
-			throw std::runtime_error("Failed to fetch the list of live nodes");
+			std::shared_ptr<AlternatorHedge> hedge = _pending_hedges.top().hedge;
+			_pending_hedges.pop();
+			lock.unlock();
+			SendScheduledHedge(hedge);
+			lock.lock();
 		}
 	}
 
-	Aws::Http::URI NextNode() const {
-		std::lock_guard<std::mutex> guard(_nodes_mutex);
-		assert(!_nodes.empty());
-		size_t idx = _node_idx;
-		_node_idx = (_node_idx + 1) % _nodes.size();
-		return _nodes[idx];
+	void SendScheduledHedge(const std::shared_ptr<AlternatorHedge>& hedge) const {
+		std::lock_guard<std::mutex> lock(hedge->mutex);
+		if (hedge->finished.load(std::memory_order_relaxed) || !TakeHedgeBudget()) {
+			return;
+		}
+		_hedges.fetch_add(1, std::memory_order_relaxed);
+		++hedge->sent;
+		if (!hedge->send(hedge)) {
+			--hedge->sent;
+		}
 	}
 
-	template<typename Duration>
-	void StartNodeUpdater(Duration duration) {
-		_keep_updating = true;
-		_node_updater = std::unique_ptr<std::thread>(new std::thread([this, duration] {
-			while (_keep_updating) {
+	bool HedgeDelay(AlternatorNode& primary, std::chrono::microseconds& delay) const {
+		if (_hedging_options.delay.count() != 0) {
+			delay = _hedging_options.delay;
+			return true;
+		}
+		// Without enough samples the percentile is too noisy to hedge on
+		return primary.latency_histogram.Percentile(_hedging_options.latency_percentile, 100, delay);
+	}
+
+	void EarnHedgeBudget() const {
+		int64_t cap = static_cast<int64_t>(_hedging_options.budget_burst) * 1000;
+		if (_hedge_budget.load(std::memory_order_relaxed) < cap) {
+			_hedge_budget.fetch_add(static_cast<int64_t>(_hedging_options.budget_ratio * 1000), std::memory_order_relaxed);
+		}
+	}
+
+	bool TakeHedgeBudget() const {
+		int64_t budget = _hedge_budget.load(std::memory_order_relaxed);
+		while (budget >= 1000) {
+			if (_hedge_budget.compare_exchange_weak(budget, budget - 1000, std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Runs fn on the client's executor and returns true, or returns false
+	// if the executor refused it. The destructor waits for all background
+	// tasks to finish.
+	bool RunInBackground(std::function<void()> fn) const {
+		{
+			std::lock_guard<std::mutex> guard(_background_tasks_mutex);
+			++_background_tasks;
+		}
+		auto task = [this, fn] {
+			try {
+				fn();
+			} catch (...) {
+				// background work is best-effort
+			}
+			FinishBackgroundTask();
+		};
+		if (!_executor->Submit(task)) {
+			FinishBackgroundTask();
+			return false;
+		}
+		return true;
+	}
+
+	void FinishBackgroundTask() const {
+		std::lock_guard<std::mutex> guard(_background_tasks_mutex);
+		if (--_background_tasks == 0) {
+			_background_tasks_done.notify_all();
+		}
+	}
+
+	// Nodes which were already known keep their AlternatorNode object,
+	// only newly discovered ones are created.
+	// Nodes which disappeared are simply no longer picked: requests already
+	// sent to them complete normally, their connections are closed by the
+	// HTTP client once idle.
+	// If the same nodes are listed, in any order, the current snapshot is
+	// kept and nobody is notified, so a refresh which changes nothing
+	// changes nothing either.
+	void PublishNodes(const std::vector<Aws::String>& hosts, const std::vector<Aws::String>& fallback_hosts, bool warm_up) {
+		std::shared_ptr<const AlternatorNodeSnapshot> previous = CurrentNodes();
+		static const AlternatorNodeSnapshot no_nodes;
+		const AlternatorNodeSnapshot& previous_fallback = previous->fallback ? *previous->fallback : no_nodes;
+		if (SameNodes(*previous, hosts) && SameNodes(previous_fallback, fallback_hosts)) {
+			if (!_topology_cache_path.empty() && _topology_cache_max_age.count() > 0
+					&& std::chrono::steady_clock::now() - _topology_cache_saved >= _topology_cache_max_age / 2) {
+				SaveTopologyCache(hosts, fallback_hosts);
+			}
+			return;
+		}
+		Aws::Map<Aws::String, std::shared_ptr<AlternatorNode>> known;
+		for (const std::shared_ptr<AlternatorNode>& node : previous->nodes) {
+			known[node->host] = node;
+		}
+		for (const std::shared_ptr<AlternatorNode>& node : previous_fallback.nodes) {
+			known[node->host] = node;
+		}
+		AlternatorNodeChanges changes;
+		std::shared_ptr<AlternatorNodeSnapshot> snapshot = std::make_shared<AlternatorNodeSnapshot>();
+		for (const Aws::String& host : hosts) {
+			snapshot->nodes.push_back(GetOrCreateNode(known, host, changes.added));
+		}
+		if (!fallback_hosts.empty()) {
+			std::shared_ptr<AlternatorNodeSnapshot> fallback = std::make_shared<AlternatorNodeSnapshot>();
+			for (const Aws::String& host : fallback_hosts) {
+				fallback->nodes.push_back(GetOrCreateNode(known, host, changes.added));
+			}
+			snapshot->fallback = fallback;
+		}
+		Aws::Set<Aws::String> listed(hosts.begin(), hosts.end());
+		listed.insert(fallback_hosts.begin(), fallback_hosts.end());
+		for (const auto& node : known) {
+			if (!listed.count(node.first)) {
+				changes.removed.push_back(node.second);
+			}
+		}
+		// New nodes enter the rotation once they have been warmed up
+		if (warm_up && _connection_options.warm_up_connections) {
+			for (const std::shared_ptr<AlternatorNode>& node : changes.added) {
+				node->quarantined.store(true);
+			}
+		}
+		_nodes.Publish(snapshot);
+		// Otherwise nodes only moved between the rack and the fallback
+		bool membership_changed = !changes.added.empty() || !changes.removed.empty();
+		if (membership_changed) {
+			_topology_epoch.fetch_add(1);
+			_last_topology_change_ms.store(std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count());
+		}
+		if (!_topology_cache_path.empty()) {
+			SaveTopologyCache(hosts, fallback_hosts);
+		}
+		_selection_policy->NodesChanged(*snapshot);
+		if (_metrics_observer) {
+			_metrics_observer->NodesChanged(*snapshot);
+			if (membership_changed) {
+				_metrics_observer->MembershipChanged(*snapshot, changes);
+			}
+		}
+		if (warm_up && _connection_options.warm_up_connections) {
+			for (const std::shared_ptr<AlternatorNode>& node : changes.added) {
+				WarmUp(node);
+			}
+		}
+	}
+
+	static bool SameNodes(const AlternatorNodeSnapshot& snapshot, const std::vector<Aws::String>& hosts) {
+		if (snapshot.nodes.size() != hosts.size()) {
+			return false;
+		}
+		Aws::Set<Aws::String> listed(hosts.begin(), hosts.end());
+		for (const std::shared_ptr<AlternatorNode>& node : snapshot.nodes) {
+			if (!listed.count(node->host)) {
+				return false;
+			}
+		}
+		return listed.size() == hosts.size();
+	}
+
+	bool LoadTopologyCache(const Aws::String& path, std::chrono::seconds max_age,
+			std::vector<Aws::String>& nodes, std::vector<Aws::String>& fallback_nodes) const {
+		std::ifstream in(path.c_str());
+		Aws::Map<Aws::String, Aws::String> header;
+		std::string line;
+		while (std::getline(in, line)) {
+			size_t space = line.find(' ');
+			Aws::String key(line.substr(0, space).c_str());
+			Aws::String value(space == std::string::npos ? "" : line.substr(space + 1).c_str());
+			if (key == "node") {
+				nodes.push_back(value);
+			} else if (key == "fallback") {
+				fallback_nodes.push_back(value);
+			} else {
+				header[key] = value;
+			}
+		}
+		if (header["protocol"] != _protocol || header["port"] != _port || header["datacenter"] != _datacenter
+				|| header["rack"] != _rack || nodes.empty()) {
+			return false;
+		}
+		int64_t saved_ms = std::strtoll(header["saved"].c_str(), nullptr, 10);
+		int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		return max_age.count() == 0 || now_ms - saved_ms <= std::chrono::duration_cast<std::chrono::milliseconds>(max_age).count();
+	}
+
+	// Writes a temporary file which then replaces the cache, so that other
+	// processes never read a partial list. Saving is best-effort.
+	void SaveTopologyCache(const std::vector<Aws::String>& hosts, const std::vector<Aws::String>& fallback_hosts) {
+		static thread_local std::minstd_rand rng(std::random_device{}());
+		std::string temporary = std::string(_topology_cache_path.c_str()) + "." + std::to_string(rng()) + ".tmp";
+		{
+			std::ofstream out(temporary.c_str(), std::ios::trunc);
+			out << "# Alternator node list, see AlternatorClient::UseTopologyCache()\n"
+				<< "protocol " << _protocol << "\n"
+				<< "port " << _port << "\n"
+				<< "datacenter " << _datacenter << "\n"
+				<< "rack " << _rack << "\n"
+				<< "saved " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count() << "\n";
+			for (const Aws::String& host : hosts) {
+				out << "node " << host << "\n";
+			}
+			for (const Aws::String& host : fallback_hosts) {
+				out << "fallback " << host << "\n";
+			}
+			out.close();
+			if (!out) {
+				std::remove(temporary.c_str());
+				return;
+			}
+		}
+		if (std::rename(temporary.c_str(), _topology_cache_path.c_str()) != 0) {
+			std::remove(temporary.c_str());
+			return;
+		}
+		_topology_cache_saved = std::chrono::steady_clock::now();
+	}
+
+	std::shared_ptr<AlternatorNode> GetOrCreateNode(const Aws::Map<Aws::String, std::shared_ptr<AlternatorNode>>& known,
+			const Aws::String& host, std::vector<std::shared_ptr<AlternatorNode>>& created) const {
+		auto it = known.find(host);
+		if (it != known.end()) {
+			return it->second;
+		}
+		created.push_back(std::make_shared<AlternatorNode>(_scheme, host, _port_number));
+		return created.back();
+	}
+
+	// Opens connections to a new node by sending it several health checks
+	// at once through the client's own HTTP client, whose connection cache
+	// then holds them for the first real requests. The node is readmitted
+	// as soon as one check succeeds, and probed like a failed node otherwise.
+	void WarmUp(const std::shared_ptr<AlternatorNode>& node) const {
+		struct WarmUpState {
+			std::atomic<uint32_t> pending;
+			std::atomic<bool> succeeded;
+		};
+		uint32_t connections = _connection_options.warm_up_connections;
+		if (_connection_options.max_connections_per_node) {
+			connections = std::min(connections, _connection_options.max_connections_per_node);
+		}
+		std::shared_ptr<WarmUpState> state = std::make_shared<WarmUpState>();
+		state->pending.store(connections);
+		state->succeeded.store(false);
+		for (uint32_t i = 0; i < connections; ++i) {
+			auto finish = [this, node, state] (bool succeeded) {
+				if (succeeded && !state->succeeded.exchange(true)) {
+					node->Readmit();
+				}
+				if (state->pending.fetch_sub(1) == 1 && !state->succeeded.load()) {
+					ProbeUntilHealthy(node);
+				}
+			};
+			bool submitted = RunInBackground([this, node, finish] {
+				bool succeeded = false;
 				try {
-					FetchLocalNodes();
-					std::this_thread::sleep_for(duration);
+					std::shared_ptr<Aws::Http::HttpRequest> request(new Aws::Http::Standard::StandardHttpRequest(node->uri, Aws::Http::HttpMethod::HTTP_GET));
+					request->SetResponseStreamFactory([] { return new std::stringstream; });
+					std::shared_ptr<Aws::Http::HttpResponse> response = MakeHttpRequest(request);
+					succeeded = response && response->GetResponseCode() == Aws::Http::HttpResponseCode::OK;
 				} catch (...) {
-					// continue the thread anyway until it's explicitly stopped
+					// counts as a failed check
 				}
+				finish(succeeded);
+			});
+			if (!submitted) {
+				finish(false);
 			}
-		}));
+		}
+	}
+
+	// The configuration of the HTTP client used for node lists and health
+	// probes: a node which cannot answer a trivial request within a second
+	// is not healthy, and another node can be asked instead.
+	static Aws::Client::ClientConfiguration ControlConfiguration(const Aws::Client::ClientConfiguration& clientConfiguration) {
+		Aws::Client::ClientConfiguration ret(clientConfiguration);
+		ret.connectTimeoutMs = std::min<long>(ret.connectTimeoutMs, 1000);
+		ret.requestTimeoutMs = std::min<long>(ret.requestTimeoutMs, 1000);
+		ret.maxConnections = 4;
+		return ret;
+	}
+
+	static Aws::Client::ClientConfiguration WithAlternatorRetryStrategy(const Aws::Client::ClientConfiguration& clientConfiguration) {
+		Aws::Client::ClientConfiguration ret(clientConfiguration);
+		std::shared_ptr<Aws::Client::RetryStrategy> retry_strategy = clientConfiguration.retryStrategy;
+		if (!retry_strategy) {
+			retry_strategy = std::make_shared<Aws::Client::DefaultRetryStrategy>();
+		}
+		if (!std::dynamic_pointer_cast<AlternatorRetryStrategy>(retry_strategy)) {
+			ret.retryStrategy = std::make_shared<AlternatorRetryStrategy>(retry_strategy);
+		}
+		return ret;
+	}
+};
+
+inline void AlternatorAttempt::End(const Aws::Client::HttpResponseOutcome& outcome) {
+	if (!node) {
+		return;
+	}
+	std::shared_ptr<AlternatorNode> finished = std::move(node);
+	node.reset();
+	finished->in_flight.fetch_sub(1, std::memory_order_relaxed);
+	bool cancelled = IsCancelled();
+	bool node_failure = !outcome.IsSuccess() && IsNodeFailure(outcome.GetError()) && !cancelled;
+	bool overload = !outcome.IsSuccess() && IsOverload(outcome.GetError()) && !cancelled;
+	if (!client->_load_header.empty()) {
+		client->RecordReportedLoad(*finished, outcome);
+	}
+	if (compressed && !outcome.IsSuccess() && RejectsCompression(outcome.GetError())) {
+		finished->rejects_compression.store(true, std::memory_order_relaxed);
+		compression_rejected = true;
+		uncompressed = true;
+	}
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::chrono::microseconds latency = std::chrono::duration_cast<std::chrono::microseconds>(now - start);
+	client->RecordAttempt(finished, !outcome.IsSuccess(), node_failure, overload, latency);
+	if (traced) {
+		client->TraceAttempt(*this, *finished, outcome, node_failure, latency);
+	}
+	if (outcome.IsSuccess()) {
+		trace_request = nullptr;
+	}
+	ended = now;
+	if (node_failure) {
+		failed_node = finished;
+	} else {
+		Finish();
+	}
+	last_node = std::move(finished);
+}
+
+// A node list shared by all clients in the process which were constructed
+// with the same protocol, nodes, port, datacenter and rack, see
+// AlternatorClient::StartSharedNodeUpdater(). A single thread refreshes it,
+// borrowing the subscribed clients in turn to fetch the list, and publishes
+// each list to every client. Clients keep their own snapshot of the list,
+// so routing a request never touches the shared state.
+class AlternatorTopology {
+public:
+	// Returns the topology of the cluster with the given key, creating it
+	// if no client uses it yet. Topologies live as long as a client does.
+	static std::shared_ptr<AlternatorTopology> Get(const Aws::String& key) {
+		std::lock_guard<std::mutex> lock(RegistryMutex());
+		Aws::Map<Aws::String, std::weak_ptr<AlternatorTopology>>& registry = Registry();
+		std::shared_ptr<AlternatorTopology> topology = registry[key].lock();
+		if (!topology) {
+			topology = std::make_shared<AlternatorTopology>();
+			registry[key] = topology;
+		}
+		for (auto it = registry.begin(); it != registry.end();) {
+			if (it->second.expired()) {
+				it = registry.erase(it);
+			} else {
+				++it;
+			}
+		}
+		return topology;
+	}
+
+	AlternatorTopology()
+		: _interval(std::chrono::milliseconds::max())
+		, _parallel_fetches(1)
+		, _next_client(0)
+		, _refreshing(nullptr)
+		, _stopping(false) {}
+
+	~AlternatorTopology() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+			_changed.notify_all();
+		}
+		if (_updater) {
+			_updater->join();
+		}
+	}
+
+	void Subscribe(AlternatorClient* client, std::chrono::milliseconds interval, size_t parallel_fetches) {
+		// Taken first, as in Publish(), so that no older list reaches the
+		// client after the current one
+		std::lock_guard<std::mutex> publish_lock(_publish_mutex);
+		std::vector<Aws::String> nodes;
+		std::vector<Aws::String> fallback_nodes;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_clients.push_back(Subscriber{ client, interval, parallel_fetches });
+			_interval = std::min(_interval, interval);
+			_parallel_fetches = std::max(_parallel_fetches, parallel_fetches);
+			nodes = _nodes;
+			fallback_nodes = _fallback_nodes;
+			if (!_updater) {
+				_updater = std::unique_ptr<std::thread>(new std::thread([this] { Run(); }));
+			}
+			_changed.notify_all();
+		}
+		if (!nodes.empty()) {
+			client->PublishNodes(nodes, fallback_nodes, true);
+		}
+	}
+
+	// Once this returns, the topology no longer uses the client
+	void Unsubscribe(AlternatorClient* client) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_clients.erase(std::remove_if(_clients.begin(), _clients.end(), [client] (const Subscriber& subscriber) {
+				return subscriber.client == client;
+			}), _clients.end());
+			// The refresh settings are those of the most demanding client left
+			_interval = std::chrono::milliseconds::max();
+			_parallel_fetches = 1;
+			for (const Subscriber& subscriber : _clients) {
+				_interval = std::min(_interval, subscriber.interval);
+				_parallel_fetches = std::max(_parallel_fetches, subscriber.parallel_fetches);
+			}
+			_changed.notify_all();
+			// A refresh through the client may still publish, so it must be
+			// over before the publish mutex is taken
+			_changed.wait(lock, [this, client] { return _refreshing != client; });
+		}
+		// Waits for a publish which started before the client was removed
+		std::lock_guard<std::mutex> publish_lock(_publish_mutex);
+	}
+
+private:
+	struct Subscriber {
+		AlternatorClient* client;
+		std::chrono::milliseconds interval;
+		size_t parallel_fetches;
+	};
+
+	std::mutex _mutex;
+	// Held while a list is published to the clients, without _mutex, so
+	// that Subscribe() and Unsubscribe() need not wait for every client
+	std::mutex _publish_mutex;
+	// Notified when clients, the interval or the refreshing client change
+	std::condition_variable _changed;
+	std::vector<Subscriber> _clients;
+	std::chrono::milliseconds _interval;
+	size_t _parallel_fetches;
+	size_t _next_client;
+	// The client whose executor and HTTP client fetch the current refresh
+	AlternatorClient* _refreshing;
+	bool _stopping;
+	std::vector<Aws::String> _nodes;
+	std::vector<Aws::String> _fallback_nodes;
+	std::unique_ptr<std::thread> _updater;
+
+	static std::mutex& RegistryMutex() {
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	static Aws::Map<Aws::String, std::weak_ptr<AlternatorTopology>>& Registry() {
+		static Aws::Map<Aws::String, std::weak_ptr<AlternatorTopology>> registry;
+		return registry;
+	}
+
+	// Called on the executor of the refreshing client
+	void Publish(const std::vector<Aws::String>& nodes, const std::vector<Aws::String>& fallback_nodes) {
+		std::lock_guard<std::mutex> publish_lock(_publish_mutex);
+		std::vector<Subscriber> clients;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_nodes = nodes;
+			_fallback_nodes = fallback_nodes;
+			clients = _clients;
+		}
+		for (const Subscriber& subscriber : clients) {
+			subscriber.client->PublishNodes(nodes, fallback_nodes, true);
+		}
+	}
+
+	void Run() {
+		std::minstd_rand rng(std::random_device{}());
+		std::chrono::milliseconds backoff(0);
+		std::unique_lock<std::mutex> lock(_mutex);
+		// The first refresh replaces the seed nodes right away
+		std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+		for (;;) {
+			// Without clients there is no interval, and the next client
+			// gets a refresh right away
+			if (_clients.empty()) {
+				_changed.wait(lock, [this] { return _stopping || !_clients.empty(); });
+				next = std::chrono::steady_clock::now();
+			}
+			_changed.wait_until(lock, next, [this, &next] {
+				return _stopping || _clients.empty() || std::chrono::steady_clock::now() >= next;
+			});
+			if (_stopping) {
+				return;
+			}
+			if (_clients.empty()) {
+				continue;
+			}
+			AlternatorClient* client = _clients[_next_client++ % _clients.size()].client;
+			_refreshing = client;
+			size_t parallel_fetches = _parallel_fetches;
+			lock.unlock();
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			bool refreshed = client->RefreshNodes(parallel_fetches, [this] (const std::vector<Aws::String>& nodes, const std::vector<Aws::String>& fallback_nodes) {
+				Publish(nodes, fallback_nodes);
+			});
+			std::chrono::microseconds latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+			lock.lock();
+			_refreshing = nullptr;
+			_changed.notify_all();
+			for (const Subscriber& subscriber : _clients) {
+				subscriber.client->RecordRefresh(refreshed, latency);
+			}
+			if (!_clients.empty()) {
+				next = std::chrono::steady_clock::now() + AlternatorClient::NextRefreshDelay(refreshed, _interval, backoff, rng);
+			}
+		}
+	}
+};
+
+inline void AlternatorClient::JoinTopology(std::chrono::milliseconds interval, size_t parallel_fetches) {
+	Aws::String key = _protocol + "|" + _port + "|" + _datacenter + "|" + _rack;
+	for (const Aws::String& seed : _seeds) {
+		key += "|" + seed;
+	}
+	_topology = AlternatorTopology::Get(key);
+	_topology->Subscribe(this, interval, parallel_fetches);
+}
+
+inline void AlternatorClient::LeaveTopology() {
+	if (_topology) {
+		_topology->Unsubscribe(this);
+		_topology.reset();
+	}
+}
+
+// Controls AlternatorBatchWriter
+struct AlternatorBatchWriterOptions {
+	// Time a write may wait for others to share its BatchWriteItem request
+	std::chrono::milliseconds max_delay;
+	// Writes per BatchWriteItem request, at most 25
+	size_t max_batch_size;
+	// Writes buffered or in flight beyond which PutItem() and DeleteItem() block
+	size_t max_outstanding;
+	// Times unprocessed items, or a whole batch failing with a retryable
+	// error once the client's retry strategy gave up, are resent before
+	// their writes fail, with a delay starting at unprocessed_backoff and
+	// doubling every time
+	uint32_t max_unprocessed_retries;
+	std::chrono::milliseconds unprocessed_backoff;
+
+	AlternatorBatchWriterOptions()
+		: max_delay(5)
+		, max_batch_size(25)
+		, max_outstanding(10000)
+		, max_unprocessed_retries(5)
+		, unprocessed_backoff(20) {}
+};
+
+// Coalesces PutItem and DeleteItem requests into BatchWriteItem requests per
+// table. A batch is sent once it is full or its oldest write has waited for
+// options.max_delay. Items which Alternator leaves unprocessed are resent,
+// to a different node, and so are batches which fail with a retryable
+// error. If Alternator rejects a whole batch, e.g. because of
+// one invalid item or two writes of the same item, its writes are sent one
+// by one instead, so that every write gets its own result. Batches are sent
+// on the client's executor, in no particular order: writes of the same item
+// which are buffered at the same time may be applied in any order.
+// Conditional writes, and writes which return values, cannot be batched.
+// The writer must be destroyed before its client. Destroying it sends all
+// buffered writes and waits for them.
+class AlternatorBatchWriter {
+public:
+	explicit AlternatorBatchWriter(AlternatorClient& client, const AlternatorBatchWriterOptions& options = AlternatorBatchWriterOptions())
+		: _client(client)
+		, _options(options)
+		, _outstanding(0)
+		, _stopping(false) {
+			_options.max_batch_size = std::max<size_t>(1, std::min<size_t>(_options.max_batch_size, 25));
+			_flusher = std::thread([this] { FlushExpired(); });
+		}
+
+	~AlternatorBatchWriter() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+			_deadlines.notify_one();
+		}
+		_flusher.join();
+		Flush();
+		std::unique_lock<std::mutex> lock(_mutex);
+		_completed.wait(lock, [this] { return _outstanding == 0; });
+	}
+
+	std::future<AlternatorWriteResult> PutItem(const Aws::DynamoDB::Model::PutItemRequest& request) {
+		if (request.ConditionExpressionHasBeenSet() || request.ExpectedHasBeenSet() || request.ReturnValuesHasBeenSet()) {
+			return Failed("Conditional PutItem requests and ones returning values cannot be batched");
+		}
+		return Add(request.GetTableName(), Aws::DynamoDB::Model::WriteRequest().WithPutRequest(
+			Aws::DynamoDB::Model::PutRequest().WithItem(request.GetItem())));
+	}
+
+	std::future<AlternatorWriteResult> DeleteItem(const Aws::DynamoDB::Model::DeleteItemRequest& request) {
+		if (request.ConditionExpressionHasBeenSet() || request.ExpectedHasBeenSet() || request.ReturnValuesHasBeenSet()) {
+			return Failed("Conditional DeleteItem requests and ones returning values cannot be batched");
+		}
+		return Add(request.GetTableName(), Aws::DynamoDB::Model::WriteRequest().WithDeleteRequest(
+			Aws::DynamoDB::Model::DeleteRequest().WithKey(request.GetKey())));
+	}
+
+	// Sends all buffered writes right away
+	void Flush() {
+		std::unique_lock<std::mutex> lock(_mutex);
+		for (auto& table : _tables) {
+			if (!table.second.writes.empty()) {
+				Send(lock, table.first, table.second);
+			}
+		}
 	}
 
 protected:
-	// GetURIForUpdates() assumes that no concurrent updates to _nodes are performed.
-	// _nodes should be locked with _nodes_mutex prior to calling this function.
-	Aws::Http::URI GetURIForUpdates() const {
-		assert(!_nodes_mutex.try_lock());
-		size_t idx = _updater_idx;
-		_updater_idx = (_updater_idx + 1) % _nodes.size();
-		Aws::Http::URI ret = _nodes[idx];
-		ret.SetPath(ret.GetPath() + "/localnodes");
+	struct Write {
+		Aws::DynamoDB::Model::WriteRequest request;
+		std::promise<AlternatorWriteResult> result;
+	};
+	typedef std::vector<Write> Batch;
+
+	struct Table {
+		Batch writes;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
+	AlternatorClient& _client;
+	AlternatorBatchWriterOptions _options;
+	std::mutex _mutex;
+	// Wakes up the flusher for a new deadline
+	std::condition_variable _deadlines;
+	// Wakes up writers waiting for max_outstanding, and the destructor
+	std::condition_variable _completed;
+	Aws::Map<Aws::String, Table> _tables;
+	size_t _outstanding;
+	bool _stopping;
+	std::thread _flusher;
+
+	static std::future<AlternatorWriteResult> Failed(const char* error) {
+		std::promise<AlternatorWriteResult> result;
+		result.set_value(AlternatorWriteResult{false, error});
+		return result.get_future();
+	}
+
+	std::future<AlternatorWriteResult> Add(const Aws::String& table_name, const Aws::DynamoDB::Model::WriteRequest& request) {
+		std::unique_lock<std::mutex> lock(_mutex);
+		_completed.wait(lock, [this] { return _outstanding < _options.max_outstanding; });
+		++_outstanding;
+		Table& table = _tables[table_name];
+		if (table.writes.empty()) {
+			table.deadline = std::chrono::steady_clock::now() + _options.max_delay;
+			_deadlines.notify_one();
+		}
+		table.writes.push_back(Write{request, std::promise<AlternatorWriteResult>()});
+		std::future<AlternatorWriteResult> ret = table.writes.back().result.get_future();
+		if (table.writes.size() >= _options.max_batch_size) {
+			Send(lock, table_name, table);
+		}
 		return ret;
 	}
+
+	void FlushExpired() {
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (!_stopping) {
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			std::chrono::steady_clock::time_point next = std::chrono::steady_clock::time_point::max();
+			for (auto& table : _tables) {
+				if (table.second.writes.empty()) {
+					continue;
+				}
+				if (table.second.deadline <= now) {
+					Send(lock, table.first, table.second);
+				} else {
+					next = std::min(next, table.second.deadline);
+				}
+			}
+			if (next == std::chrono::steady_clock::time_point::max()) {
+				_deadlines.wait(lock);
+			} else {
+				_deadlines.wait_until(lock, next);
+			}
+		}
+	}
+
+	// Takes the table's writes and hands them to the executor. Called with
+	// the lock held, which is kept - the table entry stays in place.
+	void Send(std::unique_lock<std::mutex>&, const Aws::String& table_name, Table& table) {
+		std::shared_ptr<Batch> batch = std::make_shared<Batch>(std::move(table.writes));
+		table.writes.clear();
+		Aws::String name = table_name;
+		if (!_client.RunInBackground([this, name, batch] { Deliver(name, *batch); })) {
+			for (Write& write : *batch) {
+				write.result.set_value(AlternatorWriteResult{false, "The executor refused to send the batch"});
+			}
+			_outstanding -= batch->size();
+			_completed.notify_all();
+		}
+	}
+
+	void Deliver(const Aws::String& table_name, Batch& writes) {
+		std::chrono::milliseconds backoff = _options.unprocessed_backoff;
+		for (uint32_t round = 0; ; ++round) {
+			Aws::Vector<Aws::DynamoDB::Model::WriteRequest> requests;
+			for (const Write& write : writes) {
+				requests.push_back(write.request);
+			}
+			Aws::DynamoDB::Model::BatchWriteItemRequest request;
+			request.AddRequestItems(table_name, requests);
+			if (round > 0) {
+				AlternatorAttempt::Current().AvoidLastNode(request);
+			}
+			Aws::DynamoDB::Model::BatchWriteItemOutcome outcome = _client.BatchWriteItem(request);
+			if (!outcome.IsSuccess()) {
+				if (!outcome.GetError().ShouldRetry()) {
+					DeliverOneByOne(table_name, writes);
+					return;
+				}
+				// The client has already retried as far as its retry
+				// strategy allows, so the whole batch is resent later, like
+				// unprocessed items are
+				if (round >= _options.max_unprocessed_retries || _client.WaitForShutdown(backoff)) {
+					Complete(writes, outcome.GetError().GetMessage());
+					return;
+				}
+				backoff *= 2;
+				continue;
+			}
+			const auto& unprocessed = outcome.GetResult().GetUnprocessedItems();
+			auto table_unprocessed = unprocessed.find(table_name);
+			std::vector<bool> left;
+			if (table_unprocessed != unprocessed.end()) {
+				left = Unprocessed(writes, table_unprocessed->second);
+			}
+			Batch remaining;
+			for (size_t i = 0; i < writes.size(); ++i) {
+				if (!left.empty() && left[i]) {
+					remaining.push_back(std::move(writes[i]));
+				} else {
+					Complete(writes[i], AlternatorWriteResult{true, Aws::String()});
+				}
+			}
+			if (remaining.empty()) {
+				return;
+			}
+			if (round >= _options.max_unprocessed_retries || _client.WaitForShutdown(backoff)) {
+				Complete(remaining, "The item was left unprocessed by BatchWriteItem");
+				return;
+			}
+			backoff *= 2;
+			writes = std::move(remaining);
+		}
+	}
+
+	void DeliverOneByOne(const Aws::String& table_name, Batch& writes) {
+		for (Write& write : writes) {
+			bool succeeded;
+			Aws::String error;
+			if (write.request.PutRequestHasBeenSet()) {
+				Aws::DynamoDB::Model::PutItemRequest request;
+				request.SetTableName(table_name);
+				request.SetItem(write.request.GetPutRequest().GetItem());
+				Aws::DynamoDB::Model::PutItemOutcome outcome = _client.PutItem(request);
+				succeeded = outcome.IsSuccess();
+				error = succeeded ? Aws::String() : outcome.GetError().GetMessage();
+			} else {
+				Aws::DynamoDB::Model::DeleteItemRequest request;
+				request.SetTableName(table_name);
+				request.SetKey(write.request.GetDeleteRequest().GetKey());
+				Aws::DynamoDB::Model::DeleteItemOutcome outcome = _client.DeleteItem(request);
+				succeeded = outcome.IsSuccess();
+				error = succeeded ? Aws::String() : outcome.GetError().GetMessage();
+			}
+			Complete(write, AlternatorWriteResult{succeeded, error});
+		}
+	}
+
+	// Which of the writes were left unprocessed. The writes are looked up by
+	// a hash of their top-level scalar attributes, which include the
+	// primary key, and a whole item is only compared with the writes it
+	// hashes the same as - unique in practice, as a batch cannot hold two
+	// writes of the same item.
+	static std::vector<bool> Unprocessed(const Batch& writes, const Aws::Vector<Aws::DynamoDB::Model::WriteRequest>& unprocessed) {
+		std::vector<bool> left(writes.size(), false);
+		if (unprocessed.empty()) {
+			return left;
+		}
+		std::vector<std::pair<uint64_t, size_t>> pending;
+		pending.reserve(writes.size());
+		for (size_t i = 0; i < writes.size(); ++i) {
+			pending.emplace_back(Hash(writes[i].request), i);
+		}
+		std::sort(pending.begin(), pending.end());
+		for (const Aws::DynamoDB::Model::WriteRequest& request : unprocessed) {
+			uint64_t hash = Hash(request);
+			for (auto it = std::lower_bound(pending.begin(), pending.end(), std::make_pair(hash, size_t(0)));
+					it != pending.end() && it->first == hash; ++it) {
+				if (!left[it->second] && SameWrite(writes[it->second].request, request)) {
+					left[it->second] = true;
+					break;
+				}
+			}
+		}
+		return left;
+	}
+
+	static uint64_t Hash(const Aws::DynamoDB::Model::WriteRequest& request) {
+		bool put = request.PutRequestHasBeenSet();
+		const Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue>& item = put
+			? request.GetPutRequest().GetItem() : request.GetDeleteRequest().GetKey();
+		// FNV-1a over the names and values, with the length of each
+		uint64_t hash = put ? 14695981039346656037ULL : ~14695981039346656037ULL;
+		auto mix = [&hash](const unsigned char* data, size_t length) {
+			for (size_t i = 0; i < length; ++i) {
+				hash = (hash ^ data[i]) * 1099511628211ULL;
+			}
+			hash = (hash ^ length) * 1099511628211ULL;
+		};
+		for (const auto& attribute : item) {
+			const Aws::String& s = attribute.second.GetS();
+			const Aws::String& n = attribute.second.GetN();
+			const Aws::Utils::ByteBuffer& b = attribute.second.GetB();
+			mix(reinterpret_cast<const unsigned char*>(attribute.first.data()), attribute.first.size());
+			mix(reinterpret_cast<const unsigned char*>(s.data()), s.size());
+			mix(reinterpret_cast<const unsigned char*>(n.data()), n.size());
+			mix(b.GetUnderlyingData(), b.GetLength());
+		}
+		return hash;
+	}
+
+	static bool SameWrite(const Aws::DynamoDB::Model::WriteRequest& a, const Aws::DynamoDB::Model::WriteRequest& b) {
+		return a.PutRequestHasBeenSet() ? b.PutRequestHasBeenSet() && b.GetPutRequest().GetItem() == a.GetPutRequest().GetItem()
+			: b.DeleteRequestHasBeenSet() && b.GetDeleteRequest().GetKey() == a.GetDeleteRequest().GetKey();
+	}
+
+	void Complete(Batch& writes, const Aws::String& error) {
+		for (Write& write : writes) {
+			Complete(write, AlternatorWriteResult{false, error});
+		}
+	}
+
+	// The last thing done with a write, after which the destructor may return
+	void Complete(Write& write, const AlternatorWriteResult& result) {
+		write.result.set_value(result);
+		std::lock_guard<std::mutex> lock(_mutex);
+		--_outstanding;
+		_completed.notify_all();
+	}
 };
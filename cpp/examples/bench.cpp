@@ -0,0 +1,651 @@
+#include <aws/core/Aws.h>
+#include <aws/core/utils/Outcome.h>
+#include <aws/core/client/DefaultRetryStrategy.h>
+#include <aws/dynamodb/DynamoDBClient.h>
+#include <aws/dynamodb/model/AttributeDefinition.h>
+#include <aws/dynamodb/model/BatchWriteItemRequest.h>
+#include <aws/dynamodb/model/CreateTableRequest.h>
+#include <aws/dynamodb/model/GetItemRequest.h>
+#include <aws/dynamodb/model/KeySchemaElement.h>
+#include <aws/dynamodb/model/PutItemRequest.h>
+#include <aws/dynamodb/model/QueryRequest.h>
+#include <aws/dynamodb/model/ScalarAttributeType.h>
+#include <aws/dynamodb/model/WriteRequest.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../AlternatorClient.h"
+
+// Load generator for AlternatorClient. Runs a mix of GetItem, PutItem, Query
+// and BatchWriteItem requests from several threads against a cluster, or
+// against an in-process mock of Alternator, and reports throughput, latency
+// percentiles per node and the number of bytes sent and received.
+
+// Latency histogram with exact buckets up to 64us and 32 buckets per power
+// of two above, i.e. within about 3%, up to 2^46us (about 800 days), with
+// anything longer counted in the last bucket. Each thread fills its own,
+// they are merged for the report.
+class Histogram {
+public:
+    static const int SubBuckets = 64;
+    static const int Buckets = SubBuckets + 40 * SubBuckets / 2;
+
+    Histogram() : _counts(Buckets, 0), _total(0), _max(0) {}
+
+    void Record(int64_t us) {
+        ++_counts[Bucket(us)];
+        ++_total;
+        _max = std::max(_max, us);
+    }
+
+    void Merge(const Histogram& other) {
+        for (int i = 0; i < Buckets; ++i) {
+            _counts[i] += other._counts[i];
+        }
+        _total += other._total;
+        _max = std::max(_max, other._max);
+    }
+
+    uint64_t Count() const {
+        return _total;
+    }
+
+    int64_t Max() const {
+        return _max;
+    }
+
+    // Upper bound of the bucket holding the given percentile, in [0, 100]
+    int64_t Percentile(double percentile) const {
+        uint64_t rank = static_cast<uint64_t>(std::ceil(percentile / 100 * _total));
+        uint64_t seen = 0;
+        for (int i = 0; i < Buckets; ++i) {
+            seen += _counts[i];
+            if (seen >= rank && seen > 0) {
+                return std::min(UpperBound(i), _max);
+            }
+        }
+        return _max;
+    }
+
+private:
+    std::vector<uint64_t> _counts;
+    uint64_t _total;
+    int64_t _max;
+
+    static int Bucket(int64_t us) {
+        if (us < SubBuckets) {
+            return us < 0 ? 0 : static_cast<int>(us);
+        }
+        int log = 0;
+        for (int64_t v = us; v >= SubBuckets; v >>= 1) {
+            ++log;
+        }
+        int sub = static_cast<int>(us >> log) - SubBuckets / 2;
+        return std::min(SubBuckets + (log - 1) * SubBuckets / 2 + sub, Buckets - 1);
+    }
+
+    static int64_t UpperBound(int bucket) {
+        if (bucket < SubBuckets) {
+            return bucket + 1;
+        }
+        int log = (bucket - SubBuckets) / (SubBuckets / 2) + 1;
+        int sub = (bucket - SubBuckets) % (SubBuckets / 2);
+        return static_cast<int64_t>(SubBuckets / 2 + sub + 1) << log;
+    }
+};
+
+// Just enough of Alternator to route requests to: /localnodes lists the
+// configured nodes, GET / is the health check, and every DynamoDB request is
+// answered with a minimal successful response. The nodes are addresses which
+// all end up at this one server, e.g. 127.0.0.1, 127.0.0.2 and 127.0.0.3 on
+// Linux; the address a connection arrives at tells which node it is for.
+class MockAlternator {
+public:
+    MockAlternator(uint16_t port, const std::vector<std::string>& nodes, int64_t delay_us, int64_t slow_node_delay_us)
+            : _nodes(nodes), _delay_us(delay_us), _slow_node_delay_us(slow_node_delay_us), _stopping(false) {
+        _fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (bind(_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(_fd, 1024) != 0) {
+            throw std::runtime_error("Failed to listen on port " + std::to_string(port) + ": " + strerror(errno));
+        }
+        _acceptor = std::thread([this] { Accept(); });
+    }
+
+    ~MockAlternator() {
+        _stopping = true;
+        shutdown(_fd, SHUT_RDWR);
+        close(_fd);
+        _acceptor.join();
+        {
+            // Makes the servers' recv() and send() fail, so that they return
+            std::lock_guard<std::mutex> lock(_connections_mutex);
+            for (int fd : _connections) {
+                shutdown(fd, SHUT_RDWR);
+            }
+        }
+        for (std::thread& server : _servers) {
+            server.join();
+        }
+    }
+
+private:
+    std::vector<std::string> _nodes;
+    int64_t _delay_us;
+    int64_t _slow_node_delay_us;
+    int _fd;
+    std::atomic<bool> _stopping;
+    std::thread _acceptor;
+    // Only accessed by the acceptor thread, and by the destructor after it
+    // has been joined
+    std::vector<std::thread> _servers;
+    // Connections still being served
+    std::mutex _connections_mutex;
+    std::set<int> _connections;
+
+    void Accept() {
+        while (!_stopping) {
+            int fd = accept(_fd, nullptr, nullptr);
+            if (fd < 0) {
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(_connections_mutex);
+                _connections.insert(fd);
+            }
+            _servers.emplace_back([this, fd] {
+                Serve(fd);
+                std::lock_guard<std::mutex> lock(_connections_mutex);
+                _connections.erase(fd);
+                close(fd);
+            });
+        }
+    }
+
+    void Serve(int fd) {
+        sockaddr_in local;
+        socklen_t len = sizeof(local);
+        getsockname(fd, reinterpret_cast<sockaddr*>(&local), &len);
+        char local_address[INET_ADDRSTRLEN] = "";
+        inet_ntop(AF_INET, &local.sin_addr, local_address, sizeof(local_address));
+        bool slow = !_nodes.empty() && _nodes.back() == local_address && _nodes.size() > 1;
+        int64_t delay_us = _delay_us + (slow ? _slow_node_delay_us : 0);
+
+        std::string buffer;
+        char chunk[16384];
+        for (;;) {
+            size_t header_end;
+            while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+                ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+                if (n <= 0) {
+                    return;
+                }
+                buffer.append(chunk, n);
+            }
+            std::string head = buffer.substr(0, header_end);
+            std::string lower = head;
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            size_t content_length = 0;
+            size_t pos = lower.find("\r\ncontent-length:");
+            if (pos != std::string::npos) {
+                content_length = std::strtoul(head.c_str() + pos + strlen("\r\ncontent-length:"), nullptr, 10);
+            }
+            std::string target;
+            pos = lower.find("\r\nx-amz-target:");
+            if (pos != std::string::npos) {
+                size_t start = head.find('.', pos);
+                size_t end = head.find("\r\n", pos + 2);
+                if (start != std::string::npos && start < end) {
+                    target = head.substr(start + 1, end - start - 1);
+                }
+            }
+            while (buffer.size() < header_end + 4 + content_length) {
+                ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+                if (n <= 0) {
+                    return;
+                }
+                buffer.append(chunk, n);
+            }
+            buffer.erase(0, header_end + 4 + content_length);
+
+            std::string body;
+            if (head.compare(0, 4, "GET ") == 0) {
+                if (head.find(" /localnodes") != std::string::npos) {
+                    body = "[";
+                    for (size_t i = 0; i < _nodes.size(); ++i) {
+                        body += (i ? ",\"" : "\"") + _nodes[i] + "\"";
+                    }
+                    body += "]";
+                } else {
+                    body = "healthy: " + std::string(local_address);
+                }
+            } else {
+                if (delay_us) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+                }
+                body = Response(target);
+            }
+            std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/x-amz-json-1.0\r\nContent-Length: "
+                    + std::to_string(body.size()) + "\r\n\r\n" + body;
+            if (send(fd, response.data(), response.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(response.size())) {
+                return;
+            }
+        }
+    }
+
+    static std::string Response(const std::string& target) {
+        if (target == "GetItem") {
+            return "{\"Item\":{\"id\":{\"S\":\"key\"},\"value\":{\"S\":\"value\"}}}";
+        } else if (target == "Query") {
+            return "{\"Count\":0,\"Items\":[],\"ScannedCount\":0}";
+        } else if (target == "BatchWriteItem") {
+            return "{\"UnprocessedItems\":{}}";
+        } else if (target == "CreateTable") {
+            return "{\"TableDescription\":{\"TableStatus\":\"ACTIVE\"}}";
+        }
+        return "{}";
+    }
+};
+
+// Latency per node and HTTP body bytes of every attempt, recorded by the
+// thread which sends it - with --hedge-ms, hedges are sent on the
+// executor's threads - and merged for the report. There is one per process.
+class AttemptStats : public AlternatorMetricsObserver {
+public:
+    struct Shard {
+        std::mutex mutex;
+        std::map<Aws::String, Histogram> nodes;
+        std::atomic<long long> bytes_sent{0};
+        std::atomic<long long> bytes_received{0};
+    };
+
+    virtual void AttemptFinished(const AlternatorNode& node, bool, bool, std::chrono::microseconds latency) override {
+        Shard& shard = Local();
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.nodes[node.host].Record(latency.count());
+    }
+
+    // The shard of the calling thread
+    Shard& Local() {
+        static thread_local Shard* shard = nullptr;
+        if (!shard) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _shards.emplace_back(new Shard);
+            shard = _shards.back().get();
+        }
+        return *shard;
+    }
+
+    void Merge(std::map<Aws::String, Histogram>& nodes, long long& bytes_sent, long long& bytes_received) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const std::unique_ptr<Shard>& shard : _shards) {
+            std::lock_guard<std::mutex> shard_lock(shard->mutex);
+            for (const auto& node : shard->nodes) {
+                nodes[node.first].Merge(node.second);
+            }
+            bytes_sent += shard->bytes_sent.load(std::memory_order_relaxed);
+            bytes_received += shard->bytes_received.load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<Shard>> _shards;
+};
+
+// Counts the body bytes of every request it sends in an AttemptStats
+class BenchClient : public AlternatorClient {
+public:
+    BenchClient(const std::shared_ptr<AttemptStats>& stats, Aws::String protocol, Aws::String host, Aws::String port,
+            const Aws::Client::ClientConfiguration& config, Aws::String datacenter, Aws::String rack)
+            : AlternatorClient(protocol, host, port, config, datacenter, rack), _stats(stats) {
+        SetMetricsObserver(stats);
+    }
+
+protected:
+    virtual void BuildHttpRequest(const Aws::AmazonWebServiceRequest& request, const std::shared_ptr<Aws::Http::HttpRequest>& httpRequest) const override {
+        AlternatorClient::BuildHttpRequest(request, httpRequest);
+        AttemptStats::Shard* shard = &_stats->Local();
+        httpRequest->SetDataSentEventHandler([shard](const Aws::Http::HttpRequest*, long long bytes) {
+            shard->bytes_sent.fetch_add(bytes, std::memory_order_relaxed);
+        });
+        httpRequest->SetDataReceivedEventHandler([shard](const Aws::Http::HttpRequest*, Aws::Http::HttpResponse*, long long bytes) {
+            shard->bytes_received.fetch_add(bytes, std::memory_order_relaxed);
+        });
+    }
+
+private:
+    std::shared_ptr<AttemptStats> _stats;
+};
+
+enum Operation { GET_ITEM, PUT_ITEM, QUERY, BATCH_WRITE_ITEM, OPERATIONS };
+static const char* operation_names[OPERATIONS] = { "GetItem", "PutItem", "Query", "BatchWriteItem" };
+
+struct Options {
+    std::string table = "bench";
+    std::string protocol = "http";
+    std::string host = "localhost";
+    std::string port = "8000";
+    std::string datacenter;
+    std::string rack;
+    std::string policy = "round-robin";
+    int threads = 8;
+    int seconds = 10;
+    int keys = 100000;
+    int value_size = 100;
+    int batch_size = 25;
+    int weights[OPERATIONS] = { 70, 20, 5, 5 };
+    bool token_aware = false;
+    int hedge_ms = -1;
+    int mock_nodes = 0;
+    int64_t mock_delay_us = 0;
+    int64_t mock_slow_node_delay_us = 0;
+};
+
+struct ThreadStats {
+    Histogram latency[OPERATIONS];
+    uint64_t errors[OPERATIONS] = {};
+};
+
+static void Usage(const char* name) {
+    std::cout << "Usage: " << name << " [options]\n"
+            "  --table NAME           table to use, created if missing (bench)\n"
+            "  --endpoint P://H:PORT  initial node (http://localhost:8000)\n"
+            "  --datacenter DC, --rack RACK\n"
+            "  --policy round-robin|per-thread-round-robin|power-of-two-choices|load-aware\n"
+            "  --token-aware          enable token-aware routing\n"
+            "  --hedge-ms MS          hedge reads after MS milliseconds, 0 for the p99 latency\n"
+            "  --threads N (8), --seconds N (10), --keys N (100000)\n"
+            "  --value-size BYTES (100), --batch-size N (25)\n"
+            "  --mix GET,PUT,QUERY,BATCH  relative operation weights (70,20,5,5)\n"
+            "  --mock N               serve N mock nodes, 127.0.0.1 to 127.0.0.N, on the endpoint's port\n"
+            "  --mock-delay-us US     delay of every mock response\n"
+            "  --mock-slow-node-us US additional delay of the last mock node" << std::endl;
+}
+
+static bool KnownPolicy(const std::string& policy) {
+    return policy == "round-robin" || policy == "per-thread-round-robin" || policy == "power-of-two-choices" || policy == "load-aware";
+}
+
+// The sum of the operation weights, or 0 if any of them is negative
+static int TotalWeight(const Options& options) {
+    int total_weight = 0;
+    for (int weight : options.weights) {
+        if (weight < 0) {
+            return 0;
+        }
+        total_weight += weight;
+    }
+    return total_weight;
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--token-aware") {
+            options.token_aware = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--table") {
+            options.table = value;
+        } else if (arg == "--endpoint") {
+            size_t scheme_end = value.find("://");
+            size_t port_start = value.rfind(':');
+            if (scheme_end == std::string::npos || port_start <= scheme_end) {
+                return false;
+            }
+            options.protocol = value.substr(0, scheme_end);
+            options.host = value.substr(scheme_end + 3, port_start - scheme_end - 3);
+            options.port = value.substr(port_start + 1);
+        } else if (arg == "--datacenter") {
+            options.datacenter = value;
+        } else if (arg == "--rack") {
+            options.rack = value;
+        } else if (arg == "--policy") {
+            options.policy = value;
+        } else if (arg == "--hedge-ms") {
+            options.hedge_ms = std::stoi(value);
+        } else if (arg == "--threads") {
+            options.threads = std::stoi(value);
+        } else if (arg == "--seconds") {
+            options.seconds = std::stoi(value);
+        } else if (arg == "--keys") {
+            options.keys = std::stoi(value);
+        } else if (arg == "--value-size") {
+            options.value_size = std::stoi(value);
+        } else if (arg == "--batch-size") {
+            options.batch_size = std::stoi(value);
+        } else if (arg == "--mix") {
+            if (sscanf(value.c_str(), "%d,%d,%d,%d", &options.weights[0], &options.weights[1], &options.weights[2], &options.weights[3]) != 4) {
+                return false;
+            }
+        } else if (arg == "--mock") {
+            options.mock_nodes = std::stoi(value);
+        } else if (arg == "--mock-delay-us") {
+            options.mock_delay_us = std::stoll(value);
+        } else if (arg == "--mock-slow-node-us") {
+            options.mock_slow_node_delay_us = std::stoll(value);
+        } else {
+            return false;
+        }
+    }
+    return options.threads > 0 && options.seconds > 0 && options.keys > 0 && KnownPolicy(options.policy)
+            && TotalWeight(options) > 0;
+}
+
+static Aws::DynamoDB::Model::AttributeValue Key(int key) {
+    return Aws::DynamoDB::Model::AttributeValue().SetS(("key" + std::to_string(key)).c_str());
+}
+
+static void CreateTable(const AlternatorClient& client, const Options& options) {
+    Aws::DynamoDB::Model::CreateTableRequest request;
+    request.SetTableName(options.table.c_str());
+    request.SetBillingMode(Aws::DynamoDB::Model::BillingMode::PAY_PER_REQUEST);
+    request.AddAttributeDefinitions(
+        Aws::DynamoDB::Model::AttributeDefinition().WithAttributeName("id").WithAttributeType(Aws::DynamoDB::Model::ScalarAttributeType::S)
+    );
+    request.AddKeySchema(
+        Aws::DynamoDB::Model::KeySchemaElement().WithAttributeName("id").WithKeyType(Aws::DynamoDB::Model::KeyType::HASH)
+    );
+    const Aws::DynamoDB::Model::CreateTableOutcome& outcome = client.CreateTable(request);
+    if (!outcome.IsSuccess()) {
+        std::cout << "Not creating table " << options.table << ": " << outcome.GetError().GetMessage() << std::endl;
+    }
+}
+
+static bool Run(const AlternatorClient& client, const Options& options, Operation operation, std::minstd_rand& rng, const Aws::String& value) {
+    Aws::String table(options.table.c_str());
+    switch (operation) {
+    case GET_ITEM: {
+        Aws::DynamoDB::Model::GetItemRequest request;
+        request.SetTableName(table);
+        request.AddKey("id", Key(rng() % options.keys));
+        return client.GetItem(request).IsSuccess();
+    }
+    case PUT_ITEM: {
+        Aws::DynamoDB::Model::PutItemRequest request;
+        request.SetTableName(table);
+        request.AddItem("id", Key(rng() % options.keys));
+        request.AddItem("value", Aws::DynamoDB::Model::AttributeValue().SetS(value));
+        return client.PutItem(request).IsSuccess();
+    }
+    case QUERY: {
+        Aws::DynamoDB::Model::QueryRequest request;
+        request.SetTableName(table);
+        request.SetKeyConditionExpression("id = :id");
+        request.AddExpressionAttributeValues(":id", Key(rng() % options.keys));
+        return client.Query(request).IsSuccess();
+    }
+    default: {
+        Aws::Vector<Aws::DynamoDB::Model::WriteRequest> writes;
+        for (int i = 0; i < options.batch_size; ++i) {
+            Aws::DynamoDB::Model::Item item;
+            item["id"] = Key(rng() % options.keys);
+            item["value"] = Aws::DynamoDB::Model::AttributeValue().SetS(value);
+            writes.push_back(Aws::DynamoDB::Model::WriteRequest().WithPutRequest(Aws::DynamoDB::Model::PutRequest().WithItem(item)));
+        }
+        Aws::DynamoDB::Model::BatchWriteItemRequest request;
+        request.AddRequestItems(table, writes);
+        return client.BatchWriteItem(request).IsSuccess();
+    }
+    }
+}
+
+static void PrintLatency(const std::string& name, const Histogram& histogram, double seconds) {
+    std::cout << std::left << std::setw(24) << name << std::right
+            << std::setw(10) << histogram.Count()
+            << std::setw(12) << std::fixed << std::setprecision(1) << histogram.Count() / seconds
+            << std::setw(9) << histogram.Percentile(50)
+            << std::setw(9) << histogram.Percentile(90)
+            << std::setw(9) << histogram.Percentile(99)
+            << std::setw(9) << histogram.Percentile(99.9)
+            << std::setw(9) << histogram.Max() << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<MockAlternator> mock;
+    if (options.mock_nodes > 0) {
+        std::vector<std::string> nodes;
+        for (int i = 1; i <= options.mock_nodes; ++i) {
+            nodes.push_back("127.0.0." + std::to_string(i));
+        }
+        mock.reset(new MockAlternator(static_cast<uint16_t>(std::stoul(options.port)), nodes,
+                options.mock_delay_us, options.mock_slow_node_delay_us));
+        options.host = nodes.front();
+    }
+
+    Aws::SDKOptions sdk_options;
+    Aws::InitAPI(sdk_options);
+    {
+        Aws::Client::ClientConfiguration config;
+        config.verifySSL = false;
+        config.maxConnections = std::max(25, 2 * options.threads);
+        config.disableExpectHeader = true;
+        config.retryStrategy = std::shared_ptr<Aws::Client::RetryStrategy>(new Aws::Client::DefaultRetryStrategy(3, 10));
+        std::shared_ptr<AttemptStats> attempt_stats = std::make_shared<AttemptStats>();
+        BenchClient client(attempt_stats, options.protocol.c_str(), options.host.c_str(), options.port.c_str(), config,
+                options.datacenter.c_str(), options.rack.c_str());
+        if (options.policy == "power-of-two-choices") {
+            client.SetNodeSelectionPolicy(std::make_shared<AlternatorPowerOfTwoChoicesPolicy>());
+        } else if (options.policy == "load-aware") {
+            client.SetNodeSelectionPolicy(std::make_shared<AlternatorLoadAwarePolicy>());
+        } else if (options.policy == "per-thread-round-robin") {
+            client.SetNodeSelectionPolicy(std::make_shared<AlternatorPerThreadRoundRobinPolicy>());
+        }
+        if (options.token_aware) {
+            client.EnableTokenAwareRouting();
+        }
+        if (options.hedge_ms >= 0) {
+            AlternatorHedgingOptions hedging;
+            hedging.delay = std::chrono::milliseconds(options.hedge_ms);
+            client.EnableHedging(hedging);
+        }
+        client.StartNodeUpdater(std::chrono::seconds(1));
+        CreateTable(client, options);
+
+        int total_weight = TotalWeight(options);
+        std::cout << "Running " << options.threads << " threads for " << options.seconds << "s against "
+                << client.CurrentNodes()->nodes.size() << " nodes" << std::endl;
+        std::vector<ThreadStats> stats(options.threads);
+        std::vector<std::thread> threads;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point end = start + std::chrono::seconds(options.seconds);
+        for (int t = 0; t < options.threads; ++t) {
+            threads.emplace_back([&, t] {
+                ThreadStats& thread_stats = stats[t];
+                std::minstd_rand rng(t + 1);
+                Aws::String value(options.value_size, 'x');
+                for (;;) {
+                    std::chrono::steady_clock::time_point op_start = std::chrono::steady_clock::now();
+                    if (op_start >= end) {
+                        break;
+                    }
+                    int pick = rng() % total_weight;
+                    int operation = 0;
+                    while (pick >= options.weights[operation]) {
+                        pick -= options.weights[operation++];
+                    }
+                    bool succeeded = Run(client, options, static_cast<Operation>(operation), rng, value);
+                    int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - op_start).count();
+                    thread_stats.latency[operation].Record(us);
+                    if (!succeeded) {
+                        ++thread_stats.errors[operation];
+                    }
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        ThreadStats total;
+        Histogram all;
+        std::map<Aws::String, Histogram> nodes;
+        long long bytes_sent = 0;
+        long long bytes_received = 0;
+        attempt_stats->Merge(nodes, bytes_sent, bytes_received);
+        for (const ThreadStats& thread_stats : stats) {
+            for (int i = 0; i < OPERATIONS; ++i) {
+                total.latency[i].Merge(thread_stats.latency[i]);
+                total.errors[i] += thread_stats.errors[i];
+                all.Merge(thread_stats.latency[i]);
+            }
+        }
+
+        std::cout << std::endl << std::left << std::setw(24) << "latency [us]" << std::right
+                << std::setw(10) << "ops" << std::setw(12) << "ops/s" << std::setw(9) << "p50" << std::setw(9) << "p90"
+                << std::setw(9) << "p99" << std::setw(9) << "p99.9" << std::setw(9) << "max" << std::endl;
+        for (int i = 0; i < OPERATIONS; ++i) {
+            if (total.latency[i].Count()) {
+                PrintLatency(operation_names[i], total.latency[i], seconds);
+            }
+        }
+        PrintLatency("all", all, seconds);
+        std::cout << std::endl;
+        for (const auto& node : nodes) {
+            PrintLatency("node " + std::string(node.first.c_str()), node.second, seconds);
+        }
+        std::cout << std::endl;
+        for (int i = 0; i < OPERATIONS; ++i) {
+            if (total.errors[i]) {
+                std::cout << operation_names[i] << " errors: " << total.errors[i] << std::endl;
+            }
+        }
+        std::cout << "HTTP body bytes sent: " << bytes_sent << " (" << bytes_sent / seconds / 1e6 << " MB/s), received: "
+                << bytes_received << " (" << bytes_received / seconds / 1e6 << " MB/s)" << std::endl;
+    }
+    Aws::ShutdownAPI(sdk_options);
+}
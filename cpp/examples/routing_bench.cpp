@@ -0,0 +1,158 @@
+#include <aws/core/Aws.h>
+#include <aws/core/http/standard/StandardHttpRequest.h>
+#include <aws/dynamodb/DynamoDBClient.h>
+#include <aws/dynamodb/model/GetItemRequest.h>
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include "../AlternatorClient.h"
+
+// Measures the cost of routing a request, without any network I/O: the
+// clients are given a node list up front instead of fetching it, and
+// requests are built but never sent. Run with e.g.
+//   ./routing_bench --benchmark_perf_counters=CACHE-MISSES,INSTRUCTIONS
+// to also count cache misses, if Google Benchmark was built with libpfm.
+
+// Allocations made by the calling thread, counted by the global operator new
+static thread_local uint64_t allocations = 0;
+
+void* operator new(std::size_t size) {
+    ++allocations;
+    void* ret = std::malloc(size ? size : 1);
+    if (!ret) {
+        throw std::bad_alloc();
+    }
+    return ret;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+enum Policy { ROUND_ROBIN, PER_THREAD_ROUND_ROBIN, POWER_OF_TWO_CHOICES };
+
+static const char* const policy_names[] = { "round-robin", "per-thread-round-robin", "power-of-two-choices" };
+
+// Also builds requests the way DynamoDBClient alone does, without routing
+class RoutingClient : public AlternatorClient {
+public:
+    using AlternatorClient::AlternatorClient;
+
+    void BuildUnroutedHttpRequest(const Aws::AmazonWebServiceRequest& request, const std::shared_ptr<Aws::Http::HttpRequest>& http_request) const {
+        Aws::DynamoDB::DynamoDBClient::BuildHttpRequest(request, http_request);
+    }
+};
+
+// One client per benchmark run, shared by all of its threads
+static std::unique_ptr<RoutingClient> client;
+
+static void SetUp(const benchmark::State& state) {
+    std::vector<Aws::String> nodes;
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        nodes.push_back(("10.0." + std::to_string(i / 256) + "." + std::to_string(i % 256)).c_str());
+    }
+    client.reset(new RoutingClient("http", nodes, "8000"));
+    if (state.range(1) == PER_THREAD_ROUND_ROBIN) {
+        client->SetNodeSelectionPolicy(std::make_shared<AlternatorPerThreadRoundRobinPolicy>());
+    } else if (state.range(1) == POWER_OF_TWO_CHOICES) {
+        client->SetNodeSelectionPolicy(std::make_shared<AlternatorPowerOfTwoChoicesPolicy>());
+    }
+}
+
+static void TearDown(const benchmark::State&) {
+    client.reset();
+}
+
+static void ReportAllocations(benchmark::State& state, uint64_t before) {
+    state.counters["allocs/op"] = benchmark::Counter(static_cast<double>(allocations - before), benchmark::Counter::kAvgIterations);
+    state.SetLabel(policy_names[state.range(1)]);
+}
+
+static void BM_NextNode(benchmark::State& state) {
+    uint64_t before = allocations;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(client->NextNode());
+    }
+    ReportAllocations(state, before);
+}
+
+static Aws::DynamoDB::Model::GetItemRequest Request() {
+    Aws::DynamoDB::Model::GetItemRequest request;
+    request.SetTableName("table");
+    request.AddKey("id", Aws::DynamoDB::Model::AttributeValue().SetS("key"));
+    return request;
+}
+
+static std::shared_ptr<Aws::Http::HttpRequest> HttpRequest() {
+    return std::shared_ptr<Aws::Http::HttpRequest>(new Aws::Http::Standard::StandardHttpRequest(
+            Aws::Http::URI("http://localhost:8000/"), Aws::Http::HttpMethod::HTTP_POST));
+}
+
+// Includes what DynamoDBClient adds to every request, i.e. serializing the
+// payload and setting headers, which BM_BuildHttpRequestBaseline measures
+// alone
+static void BM_BuildHttpRequest(benchmark::State& state) {
+    Aws::DynamoDB::Model::GetItemRequest request = Request();
+    std::shared_ptr<Aws::Http::HttpRequest> http_request = HttpRequest();
+    uint64_t before = allocations;
+    for (auto _ : state) {
+        client->BuildHttpRequest(request, http_request);
+        benchmark::DoNotOptimize(http_request->GetUri());
+    }
+    ReportAllocations(state, before);
+}
+
+// The same request built by DynamoDBClient::BuildHttpRequest() only, so the
+// difference to BM_BuildHttpRequest is the time and allocations of routing
+static void BM_BuildHttpRequestBaseline(benchmark::State& state) {
+    Aws::DynamoDB::Model::GetItemRequest request = Request();
+    std::shared_ptr<Aws::Http::HttpRequest> http_request = HttpRequest();
+    uint64_t before = allocations;
+    for (auto _ : state) {
+        client->BuildUnroutedHttpRequest(request, http_request);
+        benchmark::DoNotOptimize(http_request->GetUri());
+    }
+    ReportAllocations(state, before);
+    state.SetLabel("DynamoDBClient");
+}
+
+static void RoutingArguments(benchmark::internal::Benchmark* benchmark) {
+    for (int64_t policy : { ROUND_ROBIN, PER_THREAD_ROUND_ROBIN, POWER_OF_TWO_CHOICES }) {
+        for (int64_t nodes : { 3, 10, 50, 500 }) {
+            benchmark->Args({ nodes, policy });
+        }
+    }
+    benchmark->ArgNames({ "nodes", "policy" });
+    benchmark->Setup(SetUp)->Teardown(TearDown);
+    benchmark->Threads(1)->Threads(8)->Threads(64)->Threads(256)->UseRealTime();
+}
+
+// Neither the node count nor the policy matter without routing
+static void BaselineArguments(benchmark::internal::Benchmark* benchmark) {
+    benchmark->Args({ 3, ROUND_ROBIN });
+    benchmark->ArgNames({ "nodes", "policy" });
+    benchmark->Setup(SetUp)->Teardown(TearDown);
+    benchmark->Threads(1)->Threads(8)->Threads(64)->Threads(256)->UseRealTime();
+}
+
+BENCHMARK(BM_NextNode)->Apply(RoutingArguments);
+BENCHMARK(BM_BuildHttpRequest)->Apply(RoutingArguments);
+BENCHMARK(BM_BuildHttpRequestBaseline)->Apply(BaselineArguments);
+
+int main(int argc, char** argv) {
+    Aws::SDKOptions options;
+    Aws::InitAPI(options);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    Aws::ShutdownAPI(options);
+}
@@ -0,0 +1,213 @@
+#include <aws/core/Aws.h>
+#include <aws/dynamodb/model/BatchWriteItemRequest.h>
+#include <aws/dynamodb/model/PutItemRequest.h>
+#include <future>
+#include "../AlternatorClient.h"
+#include "mock_http.h"
+#undef NDEBUG
+#include <cassert>
+
+typedef Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue> Item;
+
+// Records the size of every BatchWriteItem request instead of sending it.
+// The first write of the first `unprocessed` requests is left unprocessed.
+class RecordingClient : public AlternatorClient {
+public:
+    explicit RecordingClient(size_t unprocessed = 0)
+        : AlternatorClient("http", std::vector<Aws::String>{ "node" }, "8000")
+        , _unprocessed(unprocessed) {}
+
+    Aws::DynamoDB::Model::BatchWriteItemOutcome BatchWriteItem(const Aws::DynamoDB::Model::BatchWriteItemRequest& request) const override {
+        const Aws::Vector<Aws::DynamoDB::Model::WriteRequest>& writes = request.GetRequestItems().at("table");
+        Aws::DynamoDB::Model::BatchWriteItemResult result;
+        std::lock_guard<std::mutex> lock(_mutex);
+        _batches.push_back(writes.size());
+        if (_unprocessed > 0) {
+            --_unprocessed;
+            result.AddUnprocessedItems("table", Aws::Vector<Aws::DynamoDB::Model::WriteRequest>(1, writes[0]));
+        }
+        _changed.notify_all();
+        return Aws::DynamoDB::Model::BatchWriteItemOutcome(result);
+    }
+
+    // The sizes of the first `count` requests, in the order they were sent
+    std::vector<size_t> WaitForBatches(size_t count) const {
+        std::unique_lock<std::mutex> lock(_mutex);
+        assert(_changed.wait_for(lock, std::chrono::seconds(10), [this, count] { return _batches.size() >= count; }));
+        return _batches;
+    }
+
+private:
+    mutable std::mutex _mutex;
+    mutable std::condition_variable _changed;
+    mutable std::vector<size_t> _batches;
+    mutable size_t _unprocessed;
+};
+
+// Exposes the matching of unprocessed items to the writes of a batch
+class MatchingWriter : public AlternatorBatchWriter {
+public:
+    using AlternatorBatchWriter::Write;
+    using AlternatorBatchWriter::Batch;
+    using AlternatorBatchWriter::Unprocessed;
+};
+
+static Aws::Http::HttpResponseCode Unavailable(const Aws::Http::HttpRequest&, Aws::IOStream&) {
+    return Aws::Http::HttpResponseCode::SERVICE_UNAVAILABLE;
+}
+
+static Aws::DynamoDB::Model::PutItemRequest Put(int n) {
+    Aws::DynamoDB::Model::PutItemRequest request;
+    request.SetTableName("table");
+    request.AddItem("p", Aws::DynamoDB::Model::AttributeValue().SetS(std::to_string(n).c_str()));
+    return request;
+}
+
+static bool Succeeded(std::future<AlternatorWriteResult>& result) {
+    return result.wait_for(std::chrono::seconds(10)) == std::future_status::ready && result.get().succeeded;
+}
+
+// Full batches are sent right away, the rest waits for Flush()
+static void TestBatchBySize() {
+    RecordingClient client;
+    AlternatorBatchWriterOptions options;
+    options.max_batch_size = 3;
+    options.max_delay = std::chrono::hours(1);
+    AlternatorBatchWriter writer(client, options);
+    std::vector<std::future<AlternatorWriteResult>> results;
+    for (int i = 0; i < 7; ++i) {
+        results.push_back(writer.PutItem(Put(i)));
+    }
+    assert(client.WaitForBatches(2) == std::vector<size_t>({ 3, 3 }));
+    assert(results[6].wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout);
+    writer.Flush();
+    assert(client.WaitForBatches(3) == std::vector<size_t>({ 3, 3, 1 }));
+    for (std::future<AlternatorWriteResult>& result : results) {
+        assert(Succeeded(result));
+    }
+}
+
+// A batch which does not fill up is sent once its first write waited max_delay
+static void TestBatchByTime() {
+    RecordingClient client;
+    AlternatorBatchWriterOptions options;
+    options.max_delay = std::chrono::milliseconds(50);
+    AlternatorBatchWriter writer(client, options);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::future<AlternatorWriteResult> first = writer.PutItem(Put(0));
+    std::future<AlternatorWriteResult> second = writer.PutItem(Put(1));
+    assert(Succeeded(first) && Succeeded(second));
+    assert(std::chrono::steady_clock::now() - start >= options.max_delay);
+    assert(client.WaitForBatches(1) == std::vector<size_t>({ 2 }));
+}
+
+// An unprocessed write is resent on its own, and only then completed
+static void TestResendUnprocessed() {
+    RecordingClient client(1);
+    AlternatorBatchWriterOptions options;
+    options.max_batch_size = 3;
+    options.unprocessed_backoff = std::chrono::milliseconds(1);
+    AlternatorBatchWriter writer(client, options);
+    std::vector<std::future<AlternatorWriteResult>> results;
+    for (int i = 0; i < 3; ++i) {
+        results.push_back(writer.PutItem(Put(i)));
+    }
+    for (std::future<AlternatorWriteResult>& result : results) {
+        assert(Succeeded(result));
+    }
+    assert(client.WaitForBatches(2) == std::vector<size_t>({ 3, 1 }));
+}
+
+// Reads the put requests of a BatchWriteItem body written for table "table"
+static Aws::Vector<Aws::DynamoDB::Model::WriteRequest> Parse(const AlternatorItemWriter& writer) {
+    const Aws::String& body = writer.Body();
+    AlternatorJsonReader reader(body.data(), body.data() + body.size());
+    Aws::String name;
+    Aws::Vector<Aws::DynamoDB::Model::WriteRequest> requests;
+    assert(reader.BeginObject() && reader.NextMember(name) && name == "RequestItems");
+    assert(reader.BeginObject() && reader.NextMember(name) && name == "table");
+    assert(reader.BeginArray());
+    while (reader.NextElement()) {
+        assert(reader.BeginObject() && reader.NextMember(name) && name == "PutRequest");
+        assert(reader.BeginObject() && reader.NextMember(name) && name == "Item");
+        Item item;
+        assert(reader.ReadItem(item));
+        assert(!reader.NextMember(name) && !reader.NextMember(name));
+        requests.push_back(Aws::DynamoDB::Model::WriteRequest().WithPutRequest(
+            Aws::DynamoDB::Model::PutRequest().WithItem(item)));
+    }
+    assert(!reader.Failed());
+    return requests;
+}
+
+// An item with key p and number n, and with map m = {"x": x} if x is given
+static void WriteItem(AlternatorItemWriter& writer, const char* p, int64_t n, const char* x = nullptr) {
+    writer.BeginItem();
+    writer.String("p", p);
+    writer.Number("n", n);
+    if (x) {
+        writer.BeginMap("m");
+        writer.String("x", x);
+        writer.EndMap();
+    }
+    writer.EndItem();
+}
+
+static void TestUnprocessed() {
+    AlternatorItemWriter sent;
+    sent.BeginBatchWrite("table");
+    WriteItem(sent, "k0", 0);
+    WriteItem(sent, "k1", 1);
+    WriteItem(sent, "k2", 2);
+    // Two items which differ only in a map, so they hash the same
+    WriteItem(sent, "same", 3, "a");
+    WriteItem(sent, "same", 3, "b");
+    sent.End();
+    MatchingWriter::Batch batch;
+    for (const Aws::DynamoDB::Model::WriteRequest& request : Parse(sent)) {
+        batch.push_back(MatchingWriter::Write{request, std::promise<AlternatorWriteResult>()});
+    }
+    Item key;
+    key["p"] = Aws::DynamoDB::Model::AttributeValue().SetS("k3");
+    batch.push_back(MatchingWriter::Write{Aws::DynamoDB::Model::WriteRequest().WithDeleteRequest(
+        Aws::DynamoDB::Model::DeleteRequest().WithKey(key)), std::promise<AlternatorWriteResult>()});
+
+    assert(MatchingWriter::Unprocessed(batch, Aws::Vector<Aws::DynamoDB::Model::WriteRequest>()) == std::vector<bool>(6, false));
+
+    // Unprocessed items come back in any order
+    AlternatorItemWriter unprocessed;
+    unprocessed.BeginBatchWrite("table");
+    WriteItem(unprocessed, "same", 3, "b");
+    WriteItem(unprocessed, "k2", 2);
+    WriteItem(unprocessed, "k0", 0);
+    unprocessed.End();
+    std::vector<bool> left = MatchingWriter::Unprocessed(batch, Parse(unprocessed));
+    assert(left == std::vector<bool>({ true, false, true, false, true, false }));
+
+    // A put of the delete's key is not the delete, and an item which was
+    // not sent matches nothing
+    AlternatorItemWriter others;
+    others.BeginBatchWrite("table");
+    others.BeginItem();
+    others.String("p", "k3");
+    others.EndItem();
+    WriteItem(others, "k1", 4);
+    WriteItem(others, "same", 3, "c");
+    others.End();
+    assert(MatchingWriter::Unprocessed(batch, Parse(others)) == std::vector<bool>(6, false));
+
+    Aws::Vector<Aws::DynamoDB::Model::WriteRequest> deleted(1, batch[5].request);
+    assert(MatchingWriter::Unprocessed(batch, deleted) == std::vector<bool>({ false, false, false, false, false, true }));
+}
+
+int main() {
+    Aws::SDKOptions options;
+    UseMockHttp(options, Unavailable);
+    Aws::InitAPI(options);
+    TestBatchBySize();
+    TestBatchByTime();
+    TestResendUnprocessed();
+    TestUnprocessed();
+    Aws::ShutdownAPI(options);
+    return 0;
+}
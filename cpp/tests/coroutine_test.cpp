@@ -0,0 +1,100 @@
+#include <aws/core/Aws.h>
+#include <aws/core/utils/threading/Executor.h>
+#include <aws/dynamodb/model/GetItemRequest.h>
+#include <future>
+#include <stdexcept>
+#include "../AlternatorClient.h"
+#include "mock_http.h"
+#undef NDEBUG
+#include <cassert>
+
+#ifndef ALTERNATOR_COROUTINES
+#error "coroutine_test needs a compiler with C++20 coroutines"
+#endif
+
+// Answers the node list fetch of the constructor, and GetItem requests
+static Aws::Http::HttpResponseCode Respond(const Aws::Http::HttpRequest& request, Aws::IOStream& body) {
+    if (request.GetUri().GetPath() == "/localnodes") {
+        body << "[\"node\"]";
+        return Aws::Http::HttpResponseCode::OK;
+    }
+    if (!request.HasHeader("x-amz-target") || request.GetHeaderValue("x-amz-target") != "DynamoDB_20120810.GetItem") {
+        return Aws::Http::HttpResponseCode::BAD_REQUEST;
+    }
+    body << "{\"Item\": {\"p\": {\"S\": \"v\"}}}";
+    return Aws::Http::HttpResponseCode::OK;
+}
+
+// A coroutine which starts right away and is never awaited itself
+struct Task {
+    struct promise_type {
+        Task get_return_object() {
+            return Task();
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+};
+
+static Aws::DynamoDB::Model::GetItemRequest Request() {
+    Aws::DynamoDB::Model::GetItemRequest request;
+    request.SetTableName("table");
+    request.AddKey("p", Aws::DynamoDB::Model::AttributeValue().SetS("k"));
+    return request;
+}
+
+static Task Get(const AlternatorClient& client, std::promise<Aws::String>& value, std::thread::id& resumed_on) {
+    Aws::DynamoDB::Model::GetItemOutcome outcome = co_await client.GetItemCo(Request());
+    resumed_on = std::this_thread::get_id();
+    assert(outcome.IsSuccess());
+    value.set_value(outcome.GetResult().GetItem().at("p").GetS());
+}
+
+// More requests are awaited at once than the pool has threads, and each
+// coroutine is resumed on an executor thread with its own outcome
+static void TestAwait() {
+    Aws::Client::ClientConfiguration config;
+    config.executor = std::make_shared<Aws::Utils::Threading::PooledThreadExecutor>(2);
+    AlternatorClient client("http", "node", "8000", config);
+    const size_t requests = 8;
+    std::vector<std::promise<Aws::String>> values(requests);
+    std::vector<std::thread::id> resumed_on(requests);
+    for (size_t i = 0; i < requests; ++i) {
+        Get(client, values[i], resumed_on[i]);
+    }
+    for (size_t i = 0; i < requests; ++i) {
+        std::future<Aws::String> value = values[i].get_future();
+        assert(value.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+        assert(value.get() == "v");
+        assert(resumed_on[i] != std::this_thread::get_id());
+    }
+}
+
+static void TestNeedsPooledExecutor() {
+    AlternatorClient client("http", "node", "8000");
+    bool thrown = false;
+    try {
+        client.GetItemCo(Request());
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+int main() {
+    Aws::SDKOptions options;
+    UseMockHttp(options, Respond);
+    Aws::InitAPI(options);
+    TestAwait();
+    TestNeedsPooledExecutor();
+    Aws::ShutdownAPI(options);
+    return 0;
+}
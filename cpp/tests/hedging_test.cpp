@@ -0,0 +1,154 @@
+#include <aws/core/Aws.h>
+#include <future>
+#include "../AlternatorClient.h"
+#include "mock_http.h"
+#undef NDEBUG
+#include <cassert>
+
+// Exposes the hedging decisions, which are made without sending anything
+class HedgingClient : public AlternatorClient {
+public:
+    explicit HedgingClient(const AlternatorHedgingOptions& options)
+        : AlternatorClient("http", std::vector<Aws::String>{ "a", "b" }, "8000") {
+            EnableHedging(options);
+        }
+
+    using AlternatorClient::HedgeDelay;
+    using AlternatorClient::EarnHedgeBudget;
+    using AlternatorClient::TakeHedgeBudget;
+    using AlternatorClient::SendScheduledHedge;
+    using AlternatorClient::ScheduleHedge;
+};
+
+static Aws::Http::HttpResponseCode Unavailable(const Aws::Http::HttpRequest&, Aws::IOStream&) {
+    return Aws::Http::HttpResponseCode::SERVICE_UNAVAILABLE;
+}
+
+static void Record(AlternatorNode& node, size_t samples, std::chrono::microseconds latency) {
+    for (size_t i = 0; i < samples; ++i) {
+        node.RecordLatency(latency);
+    }
+}
+
+// Percentiles are bucket bounds, at most 19% above the latency asked for
+static bool Near(std::chrono::microseconds delay, int64_t us) {
+    return delay.count() >= us && delay.count() <= us * 119 / 100 + 1;
+}
+
+static void TestPercentileDelay() {
+    HedgingClient client{ AlternatorHedgingOptions() };
+    AlternatorNode node(Aws::Http::Scheme::HTTP, "a", 8000);
+    std::chrono::microseconds delay(0);
+    // Too few samples to hedge on
+    Record(node, 90, std::chrono::microseconds(1000));
+    assert(!client.HedgeDelay(node, delay));
+    Record(node, 10, std::chrono::microseconds(20000));
+    assert(client.HedgeDelay(node, delay));
+    assert(Near(delay, 20000));
+}
+
+static void TestFixedDelay() {
+    AlternatorHedgingOptions options;
+    options.delay = std::chrono::microseconds(5000);
+    HedgingClient client(options);
+    AlternatorNode node(Aws::Http::Scheme::HTTP, "a", 8000);
+    std::chrono::microseconds delay(0);
+    assert(client.HedgeDelay(node, delay) && delay.count() == 5000);
+    Record(node, 100, std::chrono::microseconds(20000));
+    assert(client.HedgeDelay(node, delay) && delay.count() == 5000);
+}
+
+static void TestBudget() {
+    AlternatorHedgingOptions options;
+    options.budget_ratio = 0.5;
+    options.budget_burst = 2;
+    HedgingClient client(options);
+    // The burst is available right away
+    assert(client.TakeHedgeBudget());
+    assert(client.TakeHedgeBudget());
+    assert(!client.TakeHedgeBudget());
+    // Every read earns half a hedge
+    client.EarnHedgeBudget();
+    assert(!client.TakeHedgeBudget());
+    client.EarnHedgeBudget();
+    assert(client.TakeHedgeBudget());
+    assert(!client.TakeHedgeBudget());
+    // and the budget saves up no more than the burst
+    for (int i = 0; i < 100; ++i) {
+        client.EarnHedgeBudget();
+    }
+    assert(client.TakeHedgeBudget());
+    assert(client.TakeHedgeBudget());
+    assert(!client.TakeHedgeBudget());
+}
+
+// A hedge whose delay passed is sent only while the read is unanswered
+// and the budget lasts
+static void TestSendScheduledHedge() {
+    AlternatorHedgingOptions options;
+    options.budget_burst = 1;
+    HedgingClient client(options);
+    size_t sends = 0;
+    std::shared_ptr<AlternatorHedge> hedge = std::make_shared<AlternatorHedge>();
+    hedge->send = [&sends](const std::shared_ptr<AlternatorHedge>&) {
+        ++sends;
+        return true;
+    };
+    client.SendScheduledHedge(hedge);
+    assert(sends == 1 && hedge->sent == 2);
+    // The budget is empty now
+    std::shared_ptr<AlternatorHedge> unfunded = std::make_shared<AlternatorHedge>();
+    unfunded->send = hedge->send;
+    client.SendScheduledHedge(unfunded);
+    assert(sends == 1 && unfunded->sent == 1);
+    assert(client.GetMetrics().hedges == 1);
+    // An answered read is not hedged, and keeps the budget
+    for (int i = 0; i < 20; ++i) {
+        client.EarnHedgeBudget();
+    }
+    unfunded->Abandon();
+    client.SendScheduledHedge(unfunded);
+    assert(sends == 1 && unfunded->sent == 1);
+    assert(client.TakeHedgeBudget());
+}
+
+// The timer sends the hedge once the delay passed, unless the primary node
+// has too few samples to take a percentile from
+static void TestScheduleHedge() {
+    AlternatorHedgingOptions options;
+    options.delay = std::chrono::microseconds(1000);
+    HedgingClient client(options);
+    std::shared_ptr<AlternatorNode> node = std::make_shared<AlternatorNode>(Aws::Http::Scheme::HTTP, "a", 8000);
+    std::shared_ptr<std::promise<void>> sent = std::make_shared<std::promise<void>>();
+    std::shared_ptr<AlternatorHedge> hedge = std::make_shared<AlternatorHedge>();
+    hedge->send = [sent](const std::shared_ptr<AlternatorHedge>&) {
+        sent->set_value();
+        return true;
+    };
+    client.ScheduleHedge(*hedge, node);
+    assert(hedge->primary == node);
+    assert(sent->get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+
+    HedgingClient percentile_client{ AlternatorHedgingOptions() };
+    std::shared_ptr<AlternatorHedge> unscheduled = std::make_shared<AlternatorHedge>();
+    unscheduled->send = [](const std::shared_ptr<AlternatorHedge>&) -> bool {
+        assert(false);
+        return true;
+    };
+    percentile_client.ScheduleHedge(*unscheduled, node);
+    assert(unscheduled->primary == node);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+}
+
+int main() {
+    Aws::SDKOptions options;
+    UseMockHttp(options, Unavailable);
+    Aws::InitAPI(options);
+    TestPercentileDelay();
+    TestFixedDelay();
+    TestBudget();
+    TestSendScheduledHedge();
+    TestScheduleHedge();
+    Aws::ShutdownAPI(options);
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <aws/core/Aws.h>
+#include <string>
+#include "../AlternatorClient.h"
+#undef NDEBUG
+#include <cassert>
+
+typedef Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue> Item;
+
+static const char* const tricky = "q\"b\\s/\n\t\x01\x1f\xc3\xa9\xf0\x9f\x98\x80";
+
+static void WriteItem(AlternatorItemWriter& writer, int64_t n) {
+    const unsigned char binary[] = { 0, 1, 2, 250, 251 };
+    writer.String("id", tricky);
+    writer.String("empty", "", 0);
+    writer.Number("n", n);
+    writer.Number("d", "1.5e3", 5);
+    writer.Binary("b", binary, sizeof(binary));
+    writer.Bool("t", true);
+    writer.Null("z");
+    writer.BeginMap("m");
+    writer.String("x", "y");
+    writer.BeginList("l");
+    writer.Number(nullptr, int64_t(0));
+    writer.String(nullptr, "q");
+    writer.BeginMap(nullptr);
+    writer.EndMap();
+    writer.EndList();
+    writer.EndMap();
+    writer.Bool("f", false);
+}
+
+// Reads back an item written by WriteItem(), checking the binary, boolean
+// and null values in the JSON text itself
+static void CheckItem(AlternatorJsonReader& reader, int64_t n) {
+    const char* begin;
+    const char* end;
+    assert(reader.ReadRaw(begin, end));
+    AlternatorJsonReader raw(begin, end);
+    Item item;
+    assert(raw.ReadItem(item));
+    assert(item.size() == 9);
+    assert(item["id"].GetS() == tricky);
+    assert(item["empty"].GetS() == "");
+    assert(item["n"].GetN() == std::to_string(n).c_str());
+    assert(item["d"].GetN() == "1.5e3");
+    assert(std::string(begin, end).find("\"b\":{\"B\":\"AAEC+vs=\"}") != std::string::npos);
+    assert(std::string(begin, end).find("\"t\":{\"BOOL\":true}") != std::string::npos);
+    assert(std::string(begin, end).find("\"z\":{\"NULL\":true}") != std::string::npos);
+    assert(std::string(begin, end).find("\"f\":{\"BOOL\":false}") != std::string::npos);
+}
+
+static void TestPutItem() {
+    AlternatorItemWriter writer;
+    writer.BeginPutItem("ta\"ble");
+    WriteItem(writer, std::numeric_limits<int64_t>::min());
+    writer.End();
+    assert(std::string(writer.Operation()) == "PutItem");
+    const Aws::String& body = writer.Body();
+    AlternatorJsonReader reader(body.data(), body.data() + body.size());
+    Aws::String name;
+    Aws::String table;
+    bool item = false;
+    assert(reader.BeginObject());
+    while (reader.NextMember(name)) {
+        if (name == "TableName") {
+            assert(reader.ReadString(table));
+        } else {
+            assert(name == "Item");
+            CheckItem(reader, std::numeric_limits<int64_t>::min());
+            item = true;
+        }
+    }
+    assert(!reader.Failed() && table == "ta\"ble" && item);
+}
+
+static void TestBatchWrite() {
+    AlternatorItemWriter writer;
+    // The second batch reuses the buffer and must not carry over anything
+    for (int round = 0; round < 2; ++round) {
+        writer.BeginBatchWrite("table");
+        for (int64_t i = 0; i < 3; ++i) {
+            writer.BeginItem();
+            WriteItem(writer, -i);
+            writer.EndItem();
+        }
+        writer.End();
+        assert(writer.Items() == 3);
+    }
+    assert(std::string(writer.Operation()) == "BatchWriteItem");
+    const Aws::String& body = writer.Body();
+    AlternatorJsonReader reader(body.data(), body.data() + body.size());
+    Aws::String name;
+    int64_t items = 0;
+    assert(reader.BeginObject() && reader.NextMember(name) && name == "RequestItems");
+    assert(reader.BeginObject() && reader.NextMember(name) && name == "table");
+    assert(reader.BeginArray());
+    while (reader.NextElement()) {
+        assert(reader.BeginObject() && reader.NextMember(name) && name == "PutRequest");
+        assert(reader.BeginObject() && reader.NextMember(name) && name == "Item");
+        CheckItem(reader, -items);
+        assert(!reader.NextMember(name) && !reader.NextMember(name));
+        ++items;
+    }
+    assert(!reader.NextMember(name) && !reader.NextMember(name));
+    assert(!reader.Failed() && items == 3);
+}
+
+static void TestRequestBody() {
+    AlternatorItemWriter writer;
+    writer.BeginPutItem("t");
+    writer.String("k", "v");
+    writer.End();
+    AlternatorRawRequest request(writer.Operation(), writer.Body().data(), writer.Body().size());
+    std::shared_ptr<Aws::IOStream> body = request.GetBody();
+    body->seekg(0, std::ios_base::end);
+    assert(static_cast<size_t>(body->tellg()) == writer.Body().size());
+    body->seekg(0);
+    std::string read((std::istreambuf_iterator<char>(*body)), std::istreambuf_iterator<char>());
+    assert(read == writer.Body().c_str());
+    body->clear();
+    body->seekg(3);
+    assert(body->get() == writer.Body()[3]);
+}
+
+int main() {
+    TestPutItem();
+    TestBatchWrite();
+    TestRequestBody();
+    return 0;
+}
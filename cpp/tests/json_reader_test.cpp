@@ -0,0 +1,108 @@
+#include <aws/core/Aws.h>
+#include <cstring>
+#include "../AlternatorClient.h"
+#undef NDEBUG
+#include <cassert>
+
+typedef Aws::Map<Aws::String, Aws::DynamoDB::Model::AttributeValue> Item;
+
+// Reads a page of a Scan or Query response, as the parallel scan does
+static bool ReadPage(const char* json, std::vector<Item>& items, Item& last_key) {
+    AlternatorJsonReader reader(json, json + std::strlen(json));
+    Aws::String name;
+    reader.BeginObject();
+    while (reader.NextMember(name)) {
+        if (name == "Items") {
+            reader.BeginArray();
+            while (reader.NextElement()) {
+                items.push_back(Item());
+                reader.ReadItem(items.back());
+            }
+        } else if (name == "LastEvaluatedKey") {
+            reader.ReadItem(last_key);
+        } else {
+            reader.SkipValue();
+        }
+    }
+    return !reader.Failed();
+}
+
+static bool Accepted(const char* json) {
+    std::vector<Item> items;
+    Item last_key;
+    return ReadPage(json, items, last_key);
+}
+
+static void TestPage() {
+    const char* json = " {\"Items\": [ {\"p\": {\"S\": \"a\\\"b\\\\c\\/\\n\\u00e9\\ud83d\\ude00\"}, \"n\": {\"N\": \"-12.5e3\"},"
+            " \"m\": {\"M\": {\"x\": {\"L\": [{\"BOOL\": true}, {\"NULL\": true}]}}}, \"ss\": {\"SS\": [\"a\", \"b\"]}},\n"
+            " {\"p\": {\"S\": \"\"}} ], \"Count\": 2, \"ScannedCount\": 2,"
+            " \"LastEvaluatedKey\": {\"p\": {\"S\": \"z\"}}, \"Unknown\": [null, false, {}, [], 1.5]}";
+    std::vector<Item> items;
+    Item last_key;
+    assert(ReadPage(json, items, last_key));
+    assert(items.size() == 2);
+    assert(items[0]["p"].GetS() == "a\"b\\c/\n\xc3\xa9\xf0\x9f\x98\x80");
+    assert(items[0]["n"].GetN() == "-12.5e3");
+    assert(items[1]["p"].GetS() == "");
+    assert(last_key["p"].GetS() == "z");
+}
+
+static void TestNumbers() {
+    const char* json = "[0, -1.25, 3e2, \"x\"]";
+    AlternatorJsonReader reader(json, json + std::strlen(json));
+    double value;
+    assert(reader.BeginArray());
+    assert(reader.NextElement() && reader.ReadNumber(value) && value == 0);
+    assert(reader.NextElement() && reader.ReadNumber(value) && value == -1.25);
+    assert(reader.NextElement() && reader.Peek() == '3' && reader.ReadNumber(value) && value == 300);
+    assert(reader.NextElement() && reader.Peek() == '"' && !reader.ReadNumber(value));
+    assert(reader.Failed());
+}
+
+static void TestMalformed() {
+    // Truncated values
+    assert(!Accepted("{\"Items\": [{\"p\": {\"S\": \"abc"));
+    assert(!Accepted("{\"Items\": [{\"p\": {\"S\": \"abc\"}"));
+    assert(!Accepted("{\"Count\": tru}"));
+    assert(!Accepted("{"));
+    // Trailing and missing commas
+    assert(!Accepted("{\"Count\": 1,}"));
+    assert(!Accepted("{\"Unknown\": [1, 2,]}"));
+    assert(!Accepted("{\"Unknown\": [1 2]}"));
+    assert(!Accepted("{\"Unknown\": [,1]}"));
+    // Missing colon
+    assert(!Accepted("{\"Count\" 1}"));
+    assert(!Accepted("{\"Items\": [{\"p\" {\"S\": \"x\"}}]}"));
+    // Bad strings
+    assert(!Accepted("{\"Items\": [{\"p\": {\"S\": \"\\ud800\"}}]}"));
+    assert(!Accepted("{\"Items\": [{\"p\": {\"S\": \"\\udc00\"}}]}"));
+    assert(!Accepted("{\"Items\": [{\"p\": {\"S\": \"\\x\"}}]}"));
+    assert(!Accepted("{\"Items\": [{\"p\": {\"S\": \"\x01\"}}]}"));
+    // Attribute values with two types, or none, or an unknown one
+    assert(!Accepted("{\"Items\": [{\"p\": {\"S\": \"x\", \"N\": \"1\"}}]}"));
+    assert(!Accepted("{\"LastEvaluatedKey\": {\"p\": {\"N\": \"1\", \"N\": \"1\"}}}"));
+    assert(!Accepted("{\"Items\": [{\"p\": {}}]}"));
+    assert(!Accepted("{\"Items\": [{\"p\": {\"X\": \"x\"}}]}"));
+    // Nesting deeper than any response has
+    Aws::String deep = "{\"Unknown\": " + Aws::String(200, '[') + Aws::String(200, ']') + "}";
+    assert(!Accepted(deep.c_str()));
+}
+
+static void TestFailureSticks() {
+    const char* json = "{\"a\" 1, \"b\": 2}";
+    AlternatorJsonReader reader(json, json + std::strlen(json));
+    Aws::String name;
+    assert(reader.BeginObject());
+    assert(!reader.NextMember(name));
+    assert(reader.Failed());
+    assert(!reader.NextMember(name) && !reader.BeginObject() && !reader.BeginArray() && !reader.ReadString(name));
+}
+
+int main() {
+    TestPage();
+    TestNumbers();
+    TestMalformed();
+    TestFailureSticks();
+    return 0;
+}
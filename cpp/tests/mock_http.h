@@ -0,0 +1,67 @@
+#pragma once
+#include <aws/core/Aws.h>
+#include <aws/core/http/HttpClient.h>
+#include <aws/core/http/HttpClientFactory.h>
+#include <aws/core/http/standard/StandardHttpRequest.h>
+#include <aws/core/http/standard/StandardHttpResponse.h>
+#include <cstdlib>
+#include <functional>
+
+// Writes the body of the response to request and returns its status
+typedef std::function<Aws::Http::HttpResponseCode(const Aws::Http::HttpRequest& request, Aws::IOStream& body)> MockHandler;
+
+// An HTTP client which sends nothing, and answers every request with the handler
+class MockHttpClient : public Aws::Http::HttpClient {
+public:
+    explicit MockHttpClient(MockHandler handler) : _handler(std::move(handler)) {}
+
+    std::shared_ptr<Aws::Http::HttpResponse> MakeRequest(const std::shared_ptr<Aws::Http::HttpRequest>& request,
+            Aws::Utils::RateLimits::RateLimiterInterface* = nullptr,
+            Aws::Utils::RateLimits::RateLimiterInterface* = nullptr) const override {
+        std::shared_ptr<Aws::Http::HttpResponse> response = std::make_shared<Aws::Http::Standard::StandardHttpResponse>(request);
+        response->SetResponseCode(_handler(*request, response->GetResponseBody()));
+        response->AddHeader("content-type", "application/x-amz-json-1.0");
+        return response;
+    }
+
+private:
+    MockHandler _handler;
+};
+
+// Makes every HTTP client of the process a MockHttpClient, see UseMockHttp()
+class MockHttpClientFactory : public Aws::Http::HttpClientFactory {
+public:
+    explicit MockHttpClientFactory(MockHandler handler) : _handler(std::move(handler)) {}
+
+    std::shared_ptr<Aws::Http::HttpClient> CreateHttpClient(const Aws::Client::ClientConfiguration&) const override {
+        return std::make_shared<MockHttpClient>(_handler);
+    }
+
+    std::shared_ptr<Aws::Http::HttpRequest> CreateHttpRequest(const Aws::String& uri, Aws::Http::HttpMethod method,
+            const Aws::IOStreamFactory& factory) const override {
+        return CreateHttpRequest(Aws::Http::URI(uri), method, factory);
+    }
+
+    std::shared_ptr<Aws::Http::HttpRequest> CreateHttpRequest(const Aws::Http::URI& uri, Aws::Http::HttpMethod method,
+            const Aws::IOStreamFactory& factory) const override {
+        std::shared_ptr<Aws::Http::HttpRequest> request = std::make_shared<Aws::Http::Standard::StandardHttpRequest>(uri, method);
+        request->SetResponseStreamFactory(factory);
+        return request;
+    }
+
+private:
+    MockHandler _handler;
+};
+
+// Makes Aws::InitAPI(options) send all HTTP requests of the process to the
+// handler. The SDK is kept from asking EC2 instance metadata for a region
+// or credentials, as those requests would reach the handler too.
+inline void UseMockHttp(Aws::SDKOptions& options, MockHandler handler) {
+    setenv("AWS_EC2_METADATA_DISABLED", "true", 1);
+    setenv("AWS_DEFAULT_REGION", "us-east-1", 1);
+    setenv("AWS_ACCESS_KEY_ID", "alternator", 1);
+    setenv("AWS_SECRET_ACCESS_KEY", "secret", 1);
+    options.httpOptions.httpClientFactory_create_fn = [handler] {
+        return std::static_pointer_cast<Aws::Http::HttpClientFactory>(std::make_shared<MockHttpClientFactory>(handler));
+    };
+}
@@ -0,0 +1,25 @@
+#include <aws/core/Aws.h>
+#include <string>
+#include "../AlternatorClient.h"
+#undef NDEBUG
+#include <cassert>
+
+// The test vectors of the Cassandra drivers' Murmur3 token implementations,
+// which Scylla's partitioner matches
+
+static int64_t Token(const std::string& key) {
+    return AlternatorTableRing::Token(reinterpret_cast<const unsigned char*>(key.data()), key.size());
+}
+
+int main() {
+    std::string repeated;
+    for (int i = 0; i < 10; ++i) {
+        repeated += std::string("\x00\xff\x10\xfa\x99", 5);
+    }
+    assert(Token("123") == -7468325962851647638LL);
+    assert(Token(repeated) == 5837342703291459765LL);
+    assert(Token(std::string(8, '\xfe')) == -8927430733708461935LL);
+    assert(Token(std::string(8, '\x10')) == 1446172840243228796LL);
+    assert(Token("9223372036854775807") == 7162290910810015547LL);
+    return 0;
+}
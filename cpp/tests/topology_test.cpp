@@ -0,0 +1,91 @@
+#include <aws/core/Aws.h>
+#include <future>
+#include "../AlternatorClient.h"
+#include "mock_http.h"
+#undef NDEBUG
+#include <cassert>
+
+// Node list fetches wait while blocked, then all answer nodes a and b
+struct Fetches {
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool blocked = false;
+    size_t started = 0;
+};
+
+static Fetches& State() {
+    static Fetches fetches;
+    return fetches;
+}
+
+static Aws::Http::HttpResponseCode FetchNodes(const Aws::Http::HttpRequest&, Aws::IOStream& body) {
+    {
+        std::unique_lock<std::mutex> lock(State().mutex);
+        ++State().started;
+        State().changed.notify_all();
+        State().changed.wait(lock, [] { return !State().blocked; });
+    }
+    body << "[\"a\", \"b\"]";
+    return Aws::Http::HttpResponseCode::OK;
+}
+
+static AlternatorClient* NewClient() {
+    return new AlternatorClient("http", std::vector<Aws::String>{ "seed1", "seed2" }, "8000");
+}
+
+static bool HasFetchedNodes(const AlternatorClient& client) {
+    std::shared_ptr<const AlternatorNodeSnapshot> snapshot = client.CurrentNodes();
+    return snapshot->nodes.size() == 2 && snapshot->nodes[0]->host == "a" && snapshot->nodes[1]->host == "b";
+}
+
+static void WaitForFetches(size_t started) {
+    std::unique_lock<std::mutex> lock(State().mutex);
+    assert(State().changed.wait_for(lock, std::chrono::seconds(10), [started] { return State().started >= started; }));
+}
+
+static void SetBlocked(bool blocked) {
+    std::lock_guard<std::mutex> lock(State().mutex);
+    State().blocked = blocked;
+    State().changed.notify_all();
+}
+
+// The client the shared updater refreshes through is destroyed while its
+// fetch is in flight, and the answer is then published to it
+static void TestDestroyWhileRefreshing() {
+    SetBlocked(true);
+    size_t started = State().started;
+    AlternatorClient* client = NewClient();
+    client->StartSharedNodeUpdater(std::chrono::hours(1), 1);
+    WaitForFetches(started + 1);
+    std::future<void> destroyed = std::async(std::launch::async, [client] { delete client; });
+    // Destroying waits for the refresh
+    assert(destroyed.wait_for(std::chrono::milliseconds(100)) == std::future_status::timeout);
+    SetBlocked(false);
+    assert(destroyed.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+}
+
+// A client joining a topology gets its node list without a fetch of its own
+static void TestLateSubscriber() {
+    std::unique_ptr<AlternatorClient> first(NewClient());
+    first->StartSharedNodeUpdater(std::chrono::hours(1), 1);
+    for (int i = 0; i < 1000 && !HasFetchedNodes(*first); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert(HasFetchedNodes(*first));
+    size_t started = State().started;
+    std::unique_ptr<AlternatorClient> second(NewClient());
+    assert(!HasFetchedNodes(*second));
+    second->StartSharedNodeUpdater(std::chrono::hours(1), 1);
+    assert(HasFetchedNodes(*second));
+    assert(State().started == started);
+}
+
+int main() {
+    Aws::SDKOptions options;
+    UseMockHttp(options, FetchNodes);
+    Aws::InitAPI(options);
+    TestDestroyWhileRefreshing();
+    TestLateSubscriber();
+    Aws::ShutdownAPI(options);
+    return 0;
+}
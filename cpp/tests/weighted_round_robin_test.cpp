@@ -0,0 +1,54 @@
+#include <aws/core/Aws.h>
+#include <vector>
+#include "../AlternatorClient.h"
+#undef NDEBUG
+#include <cassert>
+
+static std::shared_ptr<AlternatorNodeSnapshot> Snapshot(const std::vector<const char*>& hosts) {
+    std::shared_ptr<AlternatorNodeSnapshot> snapshot = std::make_shared<AlternatorNodeSnapshot>();
+    for (const char* host : hosts) {
+        snapshot->nodes.push_back(std::make_shared<AlternatorNode>(Aws::Http::Scheme::HTTP, host, 8000));
+    }
+    return snapshot;
+}
+
+// nginx's example of smooth weighted round-robin: weights 5, 1 and 1 give
+// a, a, b, a, c, a, a rather than five a's in a row
+static void TestSmoothSequence() {
+    std::shared_ptr<AlternatorNodeSnapshot> snapshot = Snapshot({ "a", "b", "c" });
+    AlternatorWeightedRoundRobinPolicy policy({ { "a", 5 }, { "b", 1 }, { "c", 1 } });
+    policy.NodesChanged(*snapshot);
+    const size_t expected[] = { 0, 0, 1, 0, 2, 0, 0 };
+    for (int cycle = 0; cycle < 3; ++cycle) {
+        for (size_t node : expected) {
+            assert(policy.Select(*snapshot) == node);
+        }
+    }
+}
+
+// A snapshot the policy was not told about gets plain round-robin, even if
+// it takes the place of the old one in memory, until NodesChanged()
+static void TestNewSnapshot() {
+    AlternatorWeightedRoundRobinPolicy policy({ { "a", 5 }, { "b", 1 }, { "c", 1 } });
+    std::shared_ptr<AlternatorNodeSnapshot> old_snapshot = Snapshot({ "a", "b", "c" });
+    policy.NodesChanged(*old_snapshot);
+    old_snapshot.reset();
+    std::shared_ptr<AlternatorNodeSnapshot> snapshot = Snapshot({ "c", "b", "a" });
+    size_t first = policy.Select(*snapshot);
+    for (size_t i = 1; i < 6; ++i) {
+        assert(policy.Select(*snapshot) == (first + i) % 3);
+    }
+    policy.NodesChanged(*snapshot);
+    // The cycle goes on from the six picks so far, and ties go to the node
+    // listed first, c here
+    const size_t expected[] = { 2, 2, 0, 2, 1, 2, 2 };
+    for (size_t i = 6; i < 20; ++i) {
+        assert(policy.Select(*snapshot) == expected[i % 7]);
+    }
+}
+
+int main() {
+    TestSmoothSequence();
+    TestNewSnapshot();
+    return 0;
+}